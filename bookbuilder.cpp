@@ -0,0 +1,411 @@
+#include "bookbuilder.h"
+#include "polyglot.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    // One (position, move) pair and the games that played it
+    struct BookTally {
+        uint64_t key;
+        uint16_t move;
+        uint32_t games;
+        uint64_t points;
+    };
+
+    bool tallyLess(const BookTally& a, const BookTally& b) {
+        return a.key != b.key ? a.key < b.key : a.move < b.move;
+    }
+
+    struct BookPair {
+        uint64_t key;
+        uint16_t move;
+        bool operator==(const BookPair&) const = default;
+    };
+
+    struct BookPairHash {
+        // Polyglot keys are already random; the move only has to separate pairs of one position
+        size_t operator()(const BookPair& pair) const {
+            return static_cast<size_t>(pair.key ^ (pair.move * 0x9E3779B97F4A7C15ULL));
+        }
+    };
+
+    struct BookCount {
+        uint32_t games = 0;
+        uint64_t points = 0;
+    };
+
+    // Rough cost of one hash map entry: the node with its key and value, plus a bucket pointer
+    constexpr size_t BOOK_MAP_ENTRY_BYTES = 64;
+
+    // A sorted run of tallies stored at a tally offset in a temporary file
+    struct RunSegment {
+        std::FILE* file;
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    // A move held back until its game has replayed to the end
+    struct OpeningMove {
+        uint64_t key;
+        uint16_t move;
+        bool whiteMoved;
+    };
+
+    class BookWorker {
+    public:
+        BookWorker() = default;
+        ~BookWorker() {
+            if (spillFile) std::fclose(spillFile);
+        }
+        BookWorker(const BookWorker&) = delete;
+        BookWorker& operator=(const BookWorker&) = delete;
+
+        void add(const uint64_t key, const uint16_t move, const uint64_t points) {
+            BookCount& count = counts[{key, move}];
+            count.games++;
+            count.points += points;
+        }
+
+        // Called between games, so a game's moves never straddle two runs
+        void endGame(const size_t spillAt) {
+            games++;
+            if (counts.size() >= spillAt) spill();
+        }
+
+        // Empties the map into a vector sorted by key and move
+        std::vector<BookTally> drain() {
+            std::vector<BookTally> tallies;
+            tallies.reserve(counts.size());
+            for (const auto& [pair, count] : counts) {
+                tallies.push_back({pair.key, pair.move, count.games, count.points});
+            }
+            std::unordered_map<BookPair, BookCount, BookPairHash>().swap(counts);
+            std::sort(tallies.begin(), tallies.end(), tallyLess);
+            return tallies;
+        }
+
+        // Every run goes into one file per worker, so open files do not grow with the run count
+        std::FILE* spillFile = nullptr;
+        std::vector<RunSegment> runs;
+        uint64_t games = 0;
+        bool failed = false;
+
+    private:
+        void spill() {
+            const std::vector<BookTally> tallies = drain();
+            if (!spillFile) spillFile = std::tmpfile();
+            if (!spillFile || std::fwrite(tallies.data(), sizeof(BookTally), tallies.size(), spillFile) != tallies.size()) {
+                failed = true;
+                return;
+            }
+            runs.push_back({spillFile, spilled, tallies.size()});
+            spilled += tallies.size();
+        }
+
+        std::unordered_map<BookPair, BookCount, BookPairHash> counts;
+        uint64_t spilled = 0;
+    };
+
+    // Seeks to a byte offset that may be past 2 GB, which a long cannot hold on Windows
+    bool seekTo(std::FILE* file, const uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    // Reads a sorted run back in order, from its file segment in blocks or straight from memory
+    class RunCursor {
+    public:
+        RunCursor(const RunSegment& segment, const size_t blockTallies) : segment(segment), block(blockTallies) {
+            refill();
+        }
+        explicit RunCursor(std::vector<BookTally> tallies) : buffer(std::move(tallies)) {}
+
+        bool done() const { return position == buffer.size(); }
+        bool failed() const { return readError; }
+        const BookTally& current() const { return buffer[position]; }
+        void advance() {
+            if (++position == buffer.size() && segment.file) refill();
+        }
+
+    private:
+        // Several cursors share one file, so each read seeks to its own place first
+        void refill() {
+            const uint64_t count = std::min<uint64_t>(block, segment.count - read);
+            buffer.resize(count);
+            position = 0;
+            if (count == 0) return;
+            if (!seekTo(segment.file, (segment.offset + read) * sizeof(BookTally)) ||
+                std::fread(buffer.data(), sizeof(BookTally), count, segment.file) != count) {
+                readError = true;
+                buffer.clear();
+                return;
+            }
+            read += count;
+        }
+
+        RunSegment segment{nullptr, 0, 0};
+        size_t block = 0;
+        uint64_t read = 0;
+        std::vector<BookTally> buffer;
+        size_t position = 0;
+        bool readError = false;
+    };
+
+    // k-way merge of sorted cursors. emit sees every (key, move) pair once, its counts summed over
+    // all the cursors that had it; returning false from emit stops the merge.
+    bool mergeCursors(std::vector<RunCursor>& cursors, const std::function<bool(const BookTally& tally)>& emit) {
+        // The heap holds the cursors that still have tallies, smallest current pair on top
+        auto greater = [&](const size_t a, const size_t b) { return tallyLess(cursors[b].current(), cursors[a].current()); };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+        for (size_t i = 0; i < cursors.size(); i++) {
+            if (cursors[i].failed()) return false;
+            if (!cursors[i].done()) heap.push(i);
+        }
+
+        bool pending = false;
+        BookTally merged{};
+        while (!heap.empty()) {
+            const size_t index = heap.top();
+            heap.pop();
+            const BookTally tally = cursors[index].current();
+            cursors[index].advance();
+            if (cursors[index].failed()) return false;
+            if (!cursors[index].done()) heap.push(index);
+
+            if (pending && merged.key == tally.key && merged.move == tally.move) {
+                merged.games += tally.games;
+                merged.points += tally.points;
+                continue;
+            }
+            if (pending && !emit(merged)) return false;
+            merged = tally;
+            pending = true;
+        }
+        return !pending || emit(merged);
+    }
+}
+
+// Runs merged at once. Along with the per-cursor block size this bounds the merge's memory and,
+// because every intermediate pass writes a single file, the number of files open.
+constexpr size_t BOOK_MERGE_FAN_IN = 64;
+// Smallest read per cursor, however low the memory limit
+constexpr size_t BOOK_MIN_MERGE_BLOCK = 256;
+
+static uint64_t pointsFor(const BookBuildOptions& options, const GameResult result, const bool whiteMoved) {
+    switch (result) {
+        case GameResult::WhiteWins:
+            return whiteMoved ? options.winPoints : options.lossPoints;
+        case GameResult::BlackWins:
+            return whiteMoved ? options.lossPoints : options.winPoints;
+        case GameResult::Draw:
+            return options.drawPoints;
+        default:
+            return 0;
+    }
+}
+
+static bool writeEntry(std::FILE* out, const uint64_t key, const uint16_t move, const uint16_t weight) {
+    unsigned char bytes[POLYGLOT_ENTRY_SIZE] = {};
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = static_cast<unsigned char>(key >> (56 - 8 * i));
+    }
+    bytes[8] = static_cast<unsigned char>(move >> 8);
+    bytes[9] = static_cast<unsigned char>(move);
+    bytes[10] = static_cast<unsigned char>(weight >> 8);
+    bytes[11] = static_cast<unsigned char>(weight);
+    return std::fwrite(bytes, 1, sizeof(bytes), out) == sizeof(bytes);
+}
+
+// Filters, weighs and writes the moves of one position
+static bool writePosition(std::vector<BookTally>& moves, const BookBuildOptions& options, std::FILE* out, BookBuildStats& stats) {
+    moves.erase(std::remove_if(moves.begin(), moves.end(), [&](const BookTally& t) { return t.games < options.minGames; }),
+                moves.end());
+    uint64_t maxPoints = 0;
+    for (const BookTally& t : moves) {
+        maxPoints = std::max(maxPoints, t.points);
+    }
+    if (maxPoints == 0) return true;
+
+    // Weights are 16 bits; a popular position is scaled down as a whole so its proportions hold
+    for (BookTally& t : moves) {
+        t.points = maxPoints > UINT16_MAX ? t.points * UINT16_MAX / maxPoints : t.points;
+    }
+    moves.erase(std::remove_if(moves.begin(), moves.end(), [](const BookTally& t) { return t.points == 0; }), moves.end());
+    std::sort(moves.begin(), moves.end(), [](const BookTally& a, const BookTally& b) {
+        return a.points != b.points ? a.points > b.points : a.move < b.move;
+    });
+
+    for (const BookTally& t : moves) {
+        if (!writeEntry(out, t.key, t.move, static_cast<uint16_t>(t.points))) return false;
+        stats.entries++;
+    }
+    stats.positions++;
+    return true;
+}
+
+// Runs replayTask for every task on the workers, then merges everything they counted into the book
+static bool buildBook(const size_t taskCount, const std::function<void(BookWorker& worker, size_t task)>& replayTask,
+                      const char* path, const BookBuildOptions& options, BookBuildStats& stats) {
+    stats = BookBuildStats{};
+    const int threads = std::max(options.threads, 1);
+    std::vector<BookWorker> workers(threads);
+
+    runWorkStealing(taskCount, threads, [&](const int self, const size_t task) {
+        replayTask(workers[self], task);
+    });
+
+    std::vector<RunSegment> runs;
+    for (BookWorker& worker : workers) {
+        if (worker.failed) return false;
+        stats.games += worker.games;
+        runs.insert(runs.end(), worker.runs.begin(), worker.runs.end());
+    }
+    stats.spilledRuns = runs.size();
+
+    // Every cursor reading a run gets an equal share of the memory limit
+    const size_t block = std::max(options.memoryLimitMB * 1048576 / (BOOK_MERGE_FAN_IN * sizeof(BookTally)),
+                                  BOOK_MIN_MERGE_BLOCK);
+
+    // Intermediate passes merge groups of runs into one new file until the rest fit in one merge.
+    // Files from the previous pass are closed, and so deleted, as soon as a pass is done with them.
+    std::vector<std::FILE*> passFiles;
+    auto closeAll = [](std::vector<std::FILE*>& files) {
+        for (std::FILE* file : files) std::fclose(file);
+        files.clear();
+    };
+    while (runs.size() > BOOK_MERGE_FAN_IN) {
+        std::FILE* out = std::tmpfile();
+        if (!out) {
+            closeAll(passFiles);
+            return false;
+        }
+        std::vector<RunSegment> merged;
+        uint64_t written = 0;
+        bool ok = true;
+        for (size_t first = 0; first < runs.size() && ok; first += BOOK_MERGE_FAN_IN) {
+            std::vector<RunCursor> cursors;
+            for (size_t i = first; i < std::min(first + BOOK_MERGE_FAN_IN, runs.size()); i++) {
+                cursors.emplace_back(runs[i], block);
+            }
+            const uint64_t offset = written;
+            ok = mergeCursors(cursors, [&](const BookTally& tally) {
+                written++;
+                return std::fwrite(&tally, sizeof(tally), 1, out) == 1;
+            });
+            merged.push_back({out, offset, written - offset});
+        }
+        closeAll(passFiles);
+        passFiles.push_back(out);
+        if (!ok) {
+            closeAll(passFiles);
+            return false;
+        }
+        if (stats.mergePasses++ == 0) {
+            for (BookWorker& worker : workers) {
+                if (worker.spillFile) std::fclose(worker.spillFile);
+                worker.spillFile = nullptr;
+            }
+        }
+        runs = std::move(merged);
+    }
+
+    std::vector<RunCursor> cursors;
+    for (const RunSegment& run : runs) {
+        cursors.emplace_back(run, block);
+    }
+    for (BookWorker& worker : workers) {
+        cursors.emplace_back(worker.drain());
+    }
+
+    std::FILE* out = std::fopen(path, "wb");
+    if (!out) {
+        closeAll(passFiles);
+        return false;
+    }
+    std::vector<BookTally> position;
+    bool ok = mergeCursors(cursors, [&](const BookTally& tally) {
+        if (!position.empty() && position.back().key != tally.key) {
+            if (!writePosition(position, options, out, stats)) return false;
+            position.clear();
+        }
+        position.push_back(tally);
+        return true;
+    });
+    if (ok && !position.empty()) ok = writePosition(position, options, out, stats);
+    ok = std::fclose(out) == 0 && ok;
+    closeAll(passFiles);
+    return ok;
+}
+
+// Counts a replayed game's opening moves. A (position, move) pair repeated within the game is
+// counted once, so minGames and the weights measure games rather than visits.
+static void tallyGame(BookWorker& worker, std::vector<OpeningMove>& opening, const BookBuildOptions& options,
+                      const GameResult result, const size_t spillAt) {
+    std::sort(opening.begin(), opening.end(), [](const OpeningMove& a, const OpeningMove& b) {
+        return a.key != b.key ? a.key < b.key : a.move < b.move;
+    });
+    opening.erase(std::unique(opening.begin(), opening.end(), [](const OpeningMove& a, const OpeningMove& b) {
+        return a.key == b.key && a.move == b.move;
+    }), opening.end());
+    for (const OpeningMove& m : opening) {
+        worker.add(m.key, m.move, pointsFor(options, result, m.whiteMoved));
+    }
+    worker.endGame(spillAt);
+}
+
+// Each worker's map gets an equal share of the memory limit
+static size_t spillThreshold(const BookBuildOptions& options) {
+    const size_t bytes = options.memoryLimitMB * 1048576 / static_cast<size_t>(std::max(options.threads, 1));
+    return std::max<size_t>(bytes / BOOK_MAP_ENTRY_BYTES, 1024);
+}
+
+// Games handed to a worker at a time when building from a database
+constexpr uint64_t BOOK_GAMES_PER_TASK = 1024;
+
+bool buildPolyglotBook(const GameDatabase& db, const char* path, const BookBuildOptions& options, BookBuildStats& stats) {
+    const size_t spillAt = spillThreshold(options);
+    const size_t taskCount = static_cast<size_t>((db.gameCount() + BOOK_GAMES_PER_TASK - 1) / BOOK_GAMES_PER_TASK);
+    return buildBook(taskCount, [&](BookWorker& worker, const size_t task) {
+        // Moves are only counted once the game has replayed, so a damaged one adds nothing
+        std::vector<OpeningMove> opening;
+        const uint64_t end = std::min<uint64_t>((task + 1) * BOOK_GAMES_PER_TASK, db.gameCount());
+        for (uint64_t game = task * BOOK_GAMES_PER_TASK; game < end; game++) {
+            opening.clear();
+            const bool replayed = db.replay(game, [&](const GameData& position, const uint16_t move) {
+                opening.push_back({polyglotKey(position), toPolyglotMove(position, move), position.state.isWhiteTurn});
+            }, options.maxPlies);
+            if (replayed) tallyGame(worker, opening, options, db.record(game).result, spillAt);
+        }
+    }, path, options, stats);
+}
+
+bool buildPolyglotBook(const std::string_view pgn, const char* path, const BookBuildOptions& options, BookBuildStats& stats) {
+    const size_t spillAt = spillThreshold(options);
+    const std::vector<std::string_view> chunks = splitPgnChunks(pgn);
+    return buildBook(chunks.size(), [&](BookWorker& worker, const size_t task) {
+        // The result is only known once the whole game has replayed, so the opening is held until then
+        std::vector<OpeningMove> opening;
+
+        PgnReader reader(chunks[task]);
+        PgnGame game;
+        PgnReplay replay;
+        while (reader.next(game)) {
+            opening.clear();
+            const bool replayed = replayGame(game, replay, [&](const GameData& position, const uint16_t move) {
+                if (static_cast<int>(opening.size()) < options.maxPlies) {
+                    opening.push_back({polyglotKey(position), toPolyglotMove(position, move), position.state.isWhiteTurn});
+                }
+            });
+            if (replayed) tallyGame(worker, opening, options, replay.result, spillAt);
+        }
+    }, path, options, stats);
+}
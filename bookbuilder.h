@@ -0,0 +1,48 @@
+#pragma once
+
+#include "gamedb.h"
+#include "pgn.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// ~~~~~~~~~~~~~~~~ Polyglot book builder ~~~~~~~~~~~~~~~~
+// Replays the opening of every game on N workers, each tallying (Polyglot key, move) pairs in its
+// own hash map. A worker whose map outgrows its share of the memory limit appends it as a sorted
+// run to its temporary file and starts over. The runs and the maps left at the end are then merged
+// straight into the book, after intermediate passes when there are more runs than one merge takes.
+
+struct BookBuildOptions {
+    // Only moves played within this many plies from the start of a game are counted
+    int maxPlies = 20;
+    // Moves played in fewer games are left out; a game that repeats a position counts once
+    uint32_t minGames = 1;
+    // Points a move earns for each game its side went on to win, draw or lose, the Polyglot
+    // "book make" defaults. Games without a result count toward minGames but earn nothing.
+    uint32_t winPoints = 2;
+    uint32_t drawPoints = 1;
+    uint32_t lossPoints = 0;
+    int threads = 1;
+    // Approximate memory for the workers' hash maps, shared between them
+    size_t memoryLimitMB = 1024;
+};
+
+struct BookBuildStats {
+    uint64_t games = 0;
+    uint64_t positions = 0;
+    uint64_t entries = 0;
+    // Sorted runs written to temporary files because the memory limit was reached
+    uint64_t spilledRuns = 0;
+    // Passes that merged groups of runs before the final merge, when there were too many runs to
+    // merge at once within the memory limit
+    uint64_t mergePasses = 0;
+};
+
+// Entries are written sorted by key and, within a position, heaviest first. A position's points
+// are scaled down together when its best move would overflow a 16-bit weight, and moves that end
+// with no weight (e.g. only losses with lossPoints = 0) are left out.
+// Games whose stored moves do not replay are skipped, and left out of stats.games.
+bool buildPolyglotBook(const GameDatabase& db, const char* path, const BookBuildOptions& options, BookBuildStats& stats);
+// Same from PGN text, split between the workers with splitPgnChunks(). Games that do not replay are skipped.
+bool buildPolyglotBook(std::string_view pgn, const char* path, const BookBuildOptions& options, BookBuildStats& stats);
@@ -2,4 +2,369 @@
 // Created by adoka on 4/15/2025.
 //
 
-#include "chessengine.h"
\ No newline at end of file
+#include "chessengine.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// ~~~~~~~~~~~~~~~~ Evaluation ~~~~~~~~~~~~~~~~
+
+namespace {
+    // Indexed by PieceType; the king is never traded, so it carries no material
+    constexpr int PIECE_VALUES[NUM_PIECE_TYPES] = {100, 320, 330, 500, 900, 0};
+
+    // Bonuses for a white piece on each square, printed the usual way round: a8 first, h1 last.
+    // A white piece on square s reads entry s ^ 56 and a black piece reads entry s.
+    constexpr int PIECE_SQUARE[NUM_PIECE_TYPES][64] = {
+        { // Pawn
+             0,   0,   0,   0,   0,   0,   0,   0,
+            50,  50,  50,  50,  50,  50,  50,  50,
+            10,  10,  20,  30,  30,  20,  10,  10,
+             5,   5,  10,  25,  25,  10,   5,   5,
+             0,   0,   0,  20,  20,   0,   0,   0,
+             5,  -5, -10,   0,   0, -10,  -5,   5,
+             5,  10,  10, -20, -20,  10,  10,   5,
+             0,   0,   0,   0,   0,   0,   0,   0,
+        },
+        { // Knight
+           -50, -40, -30, -30, -30, -30, -40, -50,
+           -40, -20,   0,   0,   0,   0, -20, -40,
+           -30,   0,  10,  15,  15,  10,   0, -30,
+           -30,   5,  15,  20,  20,  15,   5, -30,
+           -30,   0,  15,  20,  20,  15,   0, -30,
+           -30,   5,  10,  15,  15,  10,   5, -30,
+           -40, -20,   0,   5,   5,   0, -20, -40,
+           -50, -40, -30, -30, -30, -30, -40, -50,
+        },
+        { // Bishop
+           -20, -10, -10, -10, -10, -10, -10, -20,
+           -10,   0,   0,   0,   0,   0,   0, -10,
+           -10,   0,   5,  10,  10,   5,   0, -10,
+           -10,   5,   5,  10,  10,   5,   5, -10,
+           -10,   0,  10,  10,  10,  10,   0, -10,
+           -10,  10,  10,  10,  10,  10,  10, -10,
+           -10,   5,   0,   0,   0,   0,   5, -10,
+           -20, -10, -10, -10, -10, -10, -10, -20,
+        },
+        { // Rook
+             0,   0,   0,   0,   0,   0,   0,   0,
+             5,  10,  10,  10,  10,  10,  10,   5,
+            -5,   0,   0,   0,   0,   0,   0,  -5,
+            -5,   0,   0,   0,   0,   0,   0,  -5,
+            -5,   0,   0,   0,   0,   0,   0,  -5,
+            -5,   0,   0,   0,   0,   0,   0,  -5,
+            -5,   0,   0,   0,   0,   0,   0,  -5,
+             0,   0,   0,   5,   5,   0,   0,   0,
+        },
+        { // Queen
+           -20, -10, -10,  -5,  -5, -10, -10, -20,
+           -10,   0,   0,   0,   0,   0,   0, -10,
+           -10,   0,   5,   5,   5,   5,   0, -10,
+            -5,   0,   5,   5,   5,   5,   0,  -5,
+             0,   0,   5,   5,   5,   5,   0,  -5,
+           -10,   5,   5,   5,   5,   5,   0, -10,
+           -10,   0,   5,   0,   0,   0,   0, -10,
+           -20, -10, -10,  -5,  -5, -10, -10, -20,
+        },
+        { // King
+           -30, -40, -40, -50, -50, -40, -40, -30,
+           -30, -40, -40, -50, -50, -40, -40, -30,
+           -30, -40, -40, -50, -50, -40, -40, -30,
+           -30, -40, -40, -50, -50, -40, -40, -30,
+           -20, -30, -30, -40, -40, -30, -30, -20,
+           -10, -20, -20, -20, -20, -20, -20, -10,
+            20,  20,   0,   0,   0,   0,  20,  20,
+            20,  30,  10,   0,   0,  10,  30,  20,
+        },
+    };
+}
+
+int evaluate(const GameData& g) {
+    int score = 0;
+    for (int type = 0; type < NUM_PIECE_TYPES; type++) {
+        uint64_t white = g.boards.pieces[WHITE][type];
+        while (white) score += PIECE_VALUES[type] + PIECE_SQUARE[type][popLsb(white) ^ 56];
+        uint64_t black = g.boards.pieces[BLACK][type];
+        while (black) score -= PIECE_VALUES[type] + PIECE_SQUARE[type][popLsb(black)];
+    }
+    return g.state.isWhiteTurn ? score : -score;
+}
+
+// ~~~~~~~~~~~~~~~~ Search ~~~~~~~~~~~~~~~~
+
+namespace {
+    // Move ordering scores, highest searched first. Quiet moves score their history count, which
+    // is kept below KILLER_SCORE.
+    constexpr int PV_SCORE = 3'000'000;
+    constexpr int CAPTURE_SCORE = 2'000'000;
+    constexpr int KILLER_SCORE = 1'000'000;
+    constexpr int HISTORY_LIMIT = 500'000;
+
+    // Half-width of the first aspiration window around the previous iteration's score, in
+    // centipawns, and the first depth that uses one. A window that fails is widened on the side
+    // that failed by a step that doubles each time.
+    constexpr int ASPIRATION_WINDOW = 25;
+    constexpr int ASPIRATION_MIN_DEPTH = 4;
+
+    // The clock is read once per this many nodes
+    constexpr uint64_t TIME_CHECK_INTERVAL = 2048;
+
+    bool inCheck(const GameData& g) {
+        const bool isWhiteTurn = g.state.isWhiteTurn;
+        return isSquareAttacked(lsb(g.boards.of(colorOf(isWhiteTurn), PieceType::King)), !isWhiteTurn, g.boards);
+    }
+
+    // Captures, en passant included, and promotions
+    bool isNoisy(const GameData& g, const uint16_t move) {
+        const int end = getEnd(move);
+        if (g.boards.pieceOn[end] != NO_PIECE || getPromo(move)) return true;
+        return end == g.state.epSquare && pieceTypeOf(g.boards.pieceOn[getStart(move)]) == PieceType::Pawn;
+    }
+
+    // Swaps the best scored move left in [index, count) into index
+    void pickMove(MoveList& moves, int* scores, const int index) {
+        int best = index;
+        for (int i = index + 1; i < moves.count; i++) {
+            if (scores[i] > scores[best]) best = i;
+        }
+        std::swap(moves.moves[index], moves.moves[best]);
+        std::swap(scores[index], scores[best]);
+    }
+
+    double secondsSince(const std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+bool chessengine::shouldStop() {
+    if (limits.nodes && nodes >= limits.nodes) {
+        stopped = true;
+    } else if (limits.timeMs && nodes % TIME_CHECK_INTERVAL == 0 &&
+               secondsSince(start) * 1000.0 >= static_cast<double>(limits.timeMs)) {
+        stopped = true;
+    }
+    return stopped;
+}
+
+void chessengine::orderMoves(const GameData& g, const MoveList& moves, int* scores, const int ply) {
+    uint16_t pvMove = INVALID_MOVE;
+    if (followingPv) {
+        if (ply < static_cast<int>(previousPv.size())) pvMove = previousPv[ply];
+        else followingPv = false;
+    }
+    bool foundPv = false;
+    const int us = colorOf(g.state.isWhiteTurn);
+
+    for (int i = 0; i < moves.count; i++) {
+        const uint16_t move = moves.moves[i];
+        const int from = getStart(move);
+        const int to = getEnd(move);
+        if (move == pvMove) {
+            scores[i] = PV_SCORE;
+            foundPv = true;
+        } else if (isNoisy(g, move)) {
+            // MVV-LVA: the most valuable victim first, then the least valuable attacker. A promotion
+            // counts as taking the piece it promotes to.
+            const uint8_t victim = g.boards.pieceOn[to];
+            int victimType = victim == NO_PIECE ? 0 : static_cast<int>(pieceTypeOf(victim));
+            if (getPromo(move)) victimType = std::max(victimType, getPromo(move));
+            scores[i] = CAPTURE_SCORE + victimType * 8 - static_cast<int>(pieceTypeOf(g.boards.pieceOn[from]));
+        } else if (move == killers[ply][0]) {
+            scores[i] = KILLER_SCORE + 1;
+        } else if (move == killers[ply][1]) {
+            scores[i] = KILLER_SCORE;
+        } else {
+            scores[i] = historyScores[us][from][to];
+        }
+    }
+    // Off the previous line; the rest of this subtree is ordered without it
+    if (!foundPv) followingPv = false;
+}
+
+int chessengine::quiescence(GameData& g, const int ply, int alpha, const int beta) {
+    pvLength[ply] = ply;
+    nodes++;
+    if (shouldStop()) return 0;
+    if (ply >= MAX_SEARCH_PLY - 1) return evaluate(g);
+
+    // In check every evasion is searched; otherwise the side to move may stand pat on the static
+    // evaluation and only captures and promotions are tried
+    const bool checked = inCheck(g);
+    int best = -INFINITE_SCORE;
+    if (!checked) {
+        best = evaluate(g);
+        if (best >= beta) return best;
+        alpha = std::max(alpha, best);
+    }
+
+    MoveList moves;
+    generateLegalMoves(g, moves);
+    if (moves.count == 0) return checked ? -MATE_SCORE + ply : 0;
+    if (!checked) {
+        int kept = 0;
+        for (int i = 0; i < moves.count; i++) {
+            if (isNoisy(g, moves.moves[i])) moves.moves[kept++] = moves.moves[i];
+        }
+        moves.count = kept;
+    }
+
+    int scores[MAX_MOVES];
+    orderMoves(g, moves, scores, ply);
+    const bool isWhiteTurn = g.state.isWhiteTurn;
+    for (int i = 0; i < moves.count; i++) {
+        pickMove(moves, scores, i);
+        const uint16_t move = moves.moves[i];
+        const UndoInfo undo = makeMove(g, move, isWhiteTurn);
+        const int score = -quiescence(g, ply + 1, -beta, -alpha);
+        unmakeMove(g, move, undo);
+        if (stopped) return 0;
+
+        if (score > best) {
+            best = score;
+            if (score > alpha) {
+                alpha = score;
+                if (alpha >= beta) break;
+            }
+        }
+    }
+    return best;
+}
+
+int chessengine::searchNode(GameData& g, int depth, const int ply, int alpha, const int beta) {
+    pvLength[ply] = ply;
+    if (ply > 0 && (g.state.moveCounter >= 100 || history.repetitions(g.state.moveCounter) > 0)) return 0;
+
+    // Checks are extended so a mate or a forced loss of material is not pushed past the horizon
+    const bool checked = inCheck(g);
+    if (checked) depth++;
+    if (depth <= 0 || ply >= MAX_SEARCH_PLY - 1) return quiescence(g, ply, alpha, beta);
+
+    nodes++;
+    if (shouldStop()) return 0;
+
+    MoveList moves;
+    generateLegalMoves(g, moves);
+    if (moves.count == 0) return checked ? -MATE_SCORE + ply : 0;
+
+    int scores[MAX_MOVES];
+    orderMoves(g, moves, scores, ply);
+    const bool isWhiteTurn = g.state.isWhiteTurn;
+    const int us = colorOf(isWhiteTurn);
+    int best = -INFINITE_SCORE;
+    for (int i = 0; i < moves.count; i++) {
+        pickMove(moves, scores, i);
+        const uint16_t move = moves.moves[i];
+        const bool quiet = !isNoisy(g, move);
+
+        const UndoInfo undo = makeMove(g, move, isWhiteTurn);
+        history.push(g.state.hash);
+        // The first move is expected to be best and gets the full window. The rest only have to be
+        // shown no better with a null window, and are searched again in full if one turns out better.
+        int score;
+        if (i == 0) {
+            score = -searchNode(g, depth - 1, ply + 1, -beta, -alpha);
+        } else {
+            score = -searchNode(g, depth - 1, ply + 1, -alpha - 1, -alpha);
+            if (score > alpha && score < beta) score = -searchNode(g, depth - 1, ply + 1, -beta, -alpha);
+        }
+        history.pop();
+        unmakeMove(g, move, undo);
+        if (stopped) return 0;
+
+        if (score <= best) continue;
+        best = score;
+        if (score <= alpha) continue;
+        alpha = score;
+        pv[ply][ply] = move;
+        for (int next = ply + 1; next < pvLength[ply + 1]; next++) pv[ply][next] = pv[ply + 1][next];
+        pvLength[ply] = std::max(pvLength[ply + 1], ply + 1);
+
+        if (alpha >= beta) {
+            if (quiet) {
+                if (killers[ply][0] != move) {
+                    killers[ply][1] = killers[ply][0];
+                    killers[ply][0] = move;
+                }
+                int& count = historyScores[us][getStart(move)][getEnd(move)];
+                count += depth * depth;
+                if (count > HISTORY_LIMIT) {
+                    for (auto& side : historyScores) for (auto& from : side) for (int& to : from) to /= 2;
+                }
+            }
+            break;
+        }
+    }
+    return best;
+}
+
+SearchResult chessengine::search(const GameData& root, const GameHistory& game, const SearchLimits& searchLimits,
+                                 const std::function<void(const SearchResult& result)>& onIteration) {
+    limits = searchLimits;
+    start = std::chrono::steady_clock::now();
+    nodes = 0;
+    stopped = false;
+    history = game;
+    if (history.keys.empty() || history.keys.back() != root.state.hash) history.push(root.state.hash);
+    previousPv.clear();
+    std::memset(killers, 0, sizeof(killers));
+    std::memset(historyScores, 0, sizeof(historyScores));
+
+    SearchResult result;
+    MoveList rootMoves;
+    generateLegalMoves(root, rootMoves);
+    if (rootMoves.count == 0) {
+        result.score = inCheck(root) ? -MATE_SCORE : 0;
+        return result;
+    }
+    // Stands in until the first iteration finishes, in case a limit cuts that short
+    result.bestMove = rootMoves.moves[0];
+
+    // Half the table is left for check extensions and quiescence below the deepest iteration
+    const int maxDepth = std::min(limits.depth > 0 ? limits.depth : MAX_SEARCH_PLY, MAX_SEARCH_PLY / 2);
+    GameData g = root;
+    for (int depth = 1; depth <= maxDepth; depth++) {
+        int delta = ASPIRATION_WINDOW;
+        int alpha = -INFINITE_SCORE;
+        int beta = INFINITE_SCORE;
+        if (depth >= ASPIRATION_MIN_DEPTH && !isMateScore(result.score)) {
+            alpha = std::max(result.score - delta, -INFINITE_SCORE);
+            beta = std::min(result.score + delta, INFINITE_SCORE);
+        }
+
+        int score = 0;
+        while (true) {
+            followingPv = true;
+            score = searchNode(g, depth, 0, alpha, beta);
+            if (stopped) break;
+            if (score <= alpha) {
+                alpha = std::max(alpha - delta, -INFINITE_SCORE);
+            } else if (score >= beta) {
+                beta = std::min(beta + delta, INFINITE_SCORE);
+            } else {
+                break;
+            }
+            delta *= 2;
+        }
+        // An unfinished iteration is thrown away; the last finished one stands
+        if (stopped) break;
+
+        result.depth = depth;
+        result.score = score;
+        result.pv.assign(pv[0], pv[0] + pvLength[0]);
+        result.bestMove = result.pv[0];
+        result.nodes = nodes;
+        result.seconds = secondsSince(start);
+        previousPv = result.pv;
+        if (onIteration) onIteration(result);
+
+        // A full-width search to this depth has already seen every shorter mate
+        if (isMateScore(score) && MATE_SCORE - std::abs(score) <= depth) break;
+        // The next iteration takes several times as long as this one, so it would not finish in time
+        if (limits.timeMs && result.seconds * 2000.0 >= static_cast<double>(limits.timeMs)) break;
+    }
+
+    result.nodes = nodes;
+    result.seconds = secondsSince(start);
+    return result;
+}
@@ -5,10 +5,79 @@
 #ifndef CHESSENGINE_H
 #define CHESSENGINE_H
 
+#include "game.h"
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
 
+// Deepest ply the search tables have room for, extensions and quiescence included
+constexpr int MAX_SEARCH_PLY = 128;
+
+// Scores are centipawns from the side to move's point of view. A mate in n plies scores
+// MATE_SCORE - n for the side delivering it.
+constexpr int MATE_SCORE = 32000;
+constexpr int INFINITE_SCORE = 32001;
+
+inline bool isMateScore(const int score) {
+    return score >= MATE_SCORE - MAX_SEARCH_PLY || score <= -MATE_SCORE + MAX_SEARCH_PLY;
+}
+
+// Material plus piece-square tables, from the side to move's point of view
+int evaluate(const GameData& g);
+
+// Any limit left at 0 is not applied; the search stops at whichever is reached first
+struct SearchLimits {
+    int depth = 0;
+    uint64_t nodes = 0;
+    int64_t timeMs = 0;
+};
+
+struct SearchResult {
+    uint16_t bestMove = INVALID_MOVE;
+    int score = 0;
+    // Last iteration that finished; bestMove, score and pv all come from it
+    int depth = 0;
+    uint64_t nodes = 0;
+    double seconds = 0.0;
+    std::vector<uint16_t> pv;
+};
+
+// Negamax principal variation search with iterative deepening and aspiration windows, built on
+// makeMove()/unmakeMove() over generateLegalMoves(). Moves are ordered by the previous iteration's
+// principal variation, captures by MVV-LVA, killer moves, then the history heuristic.
 class chessengine {
+public:
+    // Searches root until a limit is hit. game holds the positions played so far, so repeating one
+    // of them is scored as a draw. onIteration, when given, sees the result of every finished
+    // iteration. Whenever root has a legal move, bestMove is one of them.
+    SearchResult search(const GameData& root, const GameHistory& game, const SearchLimits& searchLimits,
+                        const std::function<void(const SearchResult& result)>& onIteration = nullptr);
+
+private:
+    int searchNode(GameData& g, int depth, int ply, int alpha, int beta);
+    int quiescence(GameData& g, int ply, int alpha, int beta);
+    void orderMoves(const GameData& g, const MoveList& moves, int* scores, int ply);
+    bool shouldStop();
+
+    SearchLimits limits;
+    std::chrono::steady_clock::time_point start;
+    uint64_t nodes = 0;
+    bool stopped = false;
+    GameHistory history;
+
+    // Triangular principal variation table: pv[ply] is the best line found from ply onwards
+    uint16_t pv[MAX_SEARCH_PLY][MAX_SEARCH_PLY] = {};
+    int pvLength[MAX_SEARCH_PLY] = {};
+    // The last finished iteration's line, tried first while the search walks down it
+    std::vector<uint16_t> previousPv;
+    bool followingPv = false;
 
+    // Two quiet moves per ply that recently caused a beta cutoff
+    uint16_t killers[MAX_SEARCH_PLY][2] = {};
+    // Cutoff counts for quiet moves by side, origin and destination
+    int historyScores[2][64][64] = {};
 };
 
 
@@ -0,0 +1,397 @@
+#include "bookbuilder.h"
+#include "chessengine.h"
+#include "explorer.h"
+#include "gamedb.h"
+#include "mappedfile.h"
+#include "pgn.h"
+#include "polyglot.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Usage:
+//   chesstool [options] pgn-stats <file.pgn>    replay every game and report valid/invalid counts and throughput
+//   chesstool pgn-to-db <file.pgn> <file.gdb>   convert to the binary game database, skipping invalid games
+//   chesstool db-stats <file.gdb>               replay every game in a database and report throughput
+//   chesstool [options] explorer-build <file.gdb> <file.idx>
+//                                               index the opening positions of every game
+//   chesstool explorer <file.idx> [fen]         what was played from fen (start position by default)
+//   chesstool book <file.bin> [fen]             Polyglot book moves for fen (start position by default)
+//   chesstool [options] book-build <file.gdb|file.pgn> <file.bin>
+//                                               build a Polyglot book from a game database or PGN file
+//   chesstool [options] search [fen]            search fen (start position by default) and print each iteration
+// Options:
+//   --threads N     worker threads (default 1; 0 = all hardware threads)
+//   --chunk MB      size of the pieces the file is split into between games (default 4)
+//   --plies P       explorer-build, book-build: use moves up to this many plies into each game
+//                   (default 30 for the explorer, 20 for books)
+//   --min-games G   explorer-build: leave out positions reached in fewer games;
+//                   book-build: leave out moves played in fewer games (default 1)
+//   --points W,D,L  book-build: points a move earns per win, draw and loss of its side (default 2,1,0)
+//   --memory MB     book-build: hash map memory before counts spill to sorted runs on disk (default 1024)
+//   --depth D       search: stop after this many plies (default 8 when no other limit is given)
+//   --nodes N       search: stop after this many nodes
+//   --movetime MS   search: stop after this many milliseconds
+
+// Errors beyond this many are counted but not printed
+constexpr size_t MAX_REPORTED_ERRORS = 20;
+
+static void reportError(const PgnGameError& error) {
+    const PgnReplay& replay = error.replay;
+    std::cout << "Game " << error.gameIndex + 1 << ": " << replay.error << " '" << replay.errorToken
+              << "' at byte " << replay.errorOffset << " (ply " << replay.plies + 1 << ")\n";
+}
+
+static int pgnStats(const char* path, const int threads, const size_t chunkBytes) {
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cout << "Cannot open " << path << "\n";
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const PgnIngestResult result = ingestPgn(file.view(), threads, chunkBytes);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < result.errors.size() && i < MAX_REPORTED_ERRORS; i++) {
+        reportError(result.errors[i]);
+    }
+    std::cout << "Games: " << result.valid + result.invalid << " (" << result.valid << " valid, " << result.invalid << " invalid)\n"
+              << "Plies: " << result.plies << "\n"
+              << "Time: " << seconds * 1000.0 << " ms on " << threads << " threads, "
+              << file.size() / 1048576.0 / (seconds > 0 ? seconds : 1e-9) << " MB/s, "
+              << static_cast<uint64_t>(result.plies / (seconds > 0 ? seconds : 1e-9)) << " plies/s\n";
+    return result.invalid ? 2 : 0;
+}
+
+static int pgnToDb(const char* pgnPath, const char* dbPath) {
+    MappedFile file;
+    if (!file.open(pgnPath)) {
+        std::cout << "Cannot open " << pgnPath << "\n";
+        return 1;
+    }
+    GameDbWriter writer;
+    if (!writer.open(dbPath)) {
+        std::cout << "Cannot create " << dbPath << "\n";
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    PgnReader reader(file.view());
+    PgnGame game;
+    PgnReplay replay;
+    size_t skipped = 0;
+    for (size_t index = 0; reader.next(game); index++) {
+        if (writer.addGame(game, replay)) continue;
+        if (skipped < MAX_REPORTED_ERRORS) reportError({index, replay});
+        skipped++;
+    }
+    const uint64_t bytes = writer.bytesWritten();
+    if (!writer.finish()) {
+        std::cout << "Error writing " << dbPath << "\n";
+        return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Games: " << writer.gameCount() << " stored, " << skipped << " skipped\n"
+              << "Size: " << file.size() << " -> " << bytes << " bytes ("
+              << static_cast<double>(file.size()) / static_cast<double>(bytes ? bytes : 1) << "x smaller)\n"
+              << "Time: " << seconds * 1000.0 << " ms\n";
+    return 0;
+}
+
+static int dbStats(const char* path) {
+    GameDatabase db;
+    if (!db.open(path)) {
+        std::cout << "Cannot open " << path << " as a game database\n";
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t plies = 0;
+    uint64_t results[4] = {};
+    size_t corrupt = 0;
+    for (uint64_t i = 0; i < db.gameCount(); i++) {
+        if (!db.replay(i)) {
+            if (corrupt < MAX_REPORTED_ERRORS) std::cout << "Game " << i + 1 << ": moves do not decode\n";
+            corrupt++;
+            continue;
+        }
+        plies += db.record(i).plies;
+        results[static_cast<int>(db.record(i).result)]++;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Games: " << db.gameCount() << " (" << corrupt << " corrupt)\n"
+              << "Results: +" << results[static_cast<int>(GameResult::WhiteWins)]
+              << " =" << results[static_cast<int>(GameResult::Draw)]
+              << " -" << results[static_cast<int>(GameResult::BlackWins)]
+              << " ?" << results[static_cast<int>(GameResult::Unknown)] << "\n"
+              << "Plies: " << plies << " in " << db.fileSize() << " bytes\n"
+              << "Time: " << seconds * 1000.0 << " ms, "
+              << static_cast<uint64_t>(plies / (seconds > 0 ? seconds : 1e-9)) << " plies/s\n";
+    return corrupt ? 2 : 0;
+}
+
+static int explorerBuild(const char* dbPath, const char* indexPath, const ExplorerOptions& options) {
+    GameDatabase db;
+    if (!db.open(dbPath)) {
+        std::cout << "Cannot open " << dbPath << " as a game database\n";
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    ExplorerBuildStats stats;
+    if (!buildExplorerIndex(db, indexPath, options, stats)) {
+        std::cout << "Error writing " << indexPath << "\n";
+        return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Games: " << stats.games << " (" << stats.skippedGames << " skipped, not replayable)"
+              << ", positions indexed: " << stats.positions << "\n"
+              << "Time: " << seconds * 1000.0 << " ms on " << options.threads << " threads\n";
+    return 0;
+}
+
+static double percent(const uint32_t part, const uint32_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+// Loads fen into g, or the start position when fen is null
+static bool loadPosition(const char* fen, GameData& g) {
+    if (fen) {
+        if (loadFEN(fen, g)) return true;
+        std::cout << "Invalid FEN\n";
+        return false;
+    }
+    setupStartingPosition(g);
+    setupState(g);
+    return true;
+}
+
+static int explorerQuery(const char* indexPath, const char* fen) {
+    OpeningExplorer explorer;
+    if (!explorer.open(indexPath)) {
+        std::cout << "Cannot open " << indexPath << " as an explorer index\n";
+        return 1;
+    }
+    GameData g;
+    if (!loadPosition(fen, g)) return 1;
+
+    const ExplorerPosition* position = explorer.find(g.state.hash);
+    if (!position) {
+        std::cout << "Position not in the index (positions up to ply " << explorer.maxPlies() << " are indexed)\n";
+        return 0;
+    }
+    std::cout << "Games: " << position->games << ", white " << percent(position->whiteWins, position->games)
+              << "% / draw " << percent(position->draws, position->games)
+              << "% / black " << percent(position->blackWins, position->games) << "%"
+              << ", average rating " << position->averageRating << "\n";
+
+    const ExplorerMove* moves = explorer.moves(*position);
+    for (int i = 0; i < position->moveCount; i++) {
+        char san[MAX_SAN_LENGTH];
+        moveToSAN(g, moves[i].move, san);
+        std::cout << "  " << san << ": " << moves[i].games << " games, white " << percent(moves[i].whiteWins, moves[i].games)
+                  << "% / draw " << percent(moves[i].draws, moves[i].games)
+                  << "% / black " << percent(moves[i].blackWins, moves[i].games) << "%\n";
+    }
+    return 0;
+}
+
+static int bookQuery(const char* bookPath, const char* fen) {
+    PolyglotBook book;
+    if (!book.open(bookPath)) {
+        std::cout << "Cannot open " << bookPath << " as a Polyglot book\n";
+        return 1;
+    }
+    GameData g;
+    if (!loadPosition(fen, g)) return 1;
+
+    BookMove moves[MAX_MOVES];
+    const int count = book.probe(g, moves, MAX_MOVES);
+    uint32_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += moves[i].weight;
+    }
+    std::cout << "Key: " << std::hex << polyglotKey(g) << std::dec << ", " << count << " book moves\n";
+    for (int i = 0; i < count; i++) {
+        char san[MAX_SAN_LENGTH];
+        moveToSAN(g, moves[i].move, san);
+        std::cout << "  " << san << ": weight " << moves[i].weight << " (" << percent(moves[i].weight, total) << "%)\n";
+    }
+    return 0;
+}
+
+static int bookBuild(const char* sourcePath, const char* bookPath, const BookBuildOptions& options) {
+    BookBuildStats stats;
+    bool built = false;
+    const auto start = std::chrono::steady_clock::now();
+
+    // Anything that is not a game database is read as PGN
+    GameDatabase db;
+    if (db.open(sourcePath)) {
+        built = buildPolyglotBook(db, bookPath, options, stats);
+    } else {
+        MappedFile file;
+        if (!file.open(sourcePath)) {
+            std::cout << "Cannot open " << sourcePath << "\n";
+            return 1;
+        }
+        built = buildPolyglotBook(file.view(), bookPath, options, stats);
+    }
+    if (!built) {
+        std::cout << "Error writing " << bookPath << "\n";
+        return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Games: " << stats.games << ", positions: " << stats.positions << ", entries: " << stats.entries
+              << ", runs spilled to disk: " << stats.spilledRuns << ", merge passes: " << stats.mergePasses << "\n"
+              << "Time: " << seconds * 1000.0 << " ms on " << options.threads << " threads\n";
+    return 0;
+}
+
+static void printIteration(const GameData& root, const SearchResult& result) {
+    std::cout << "depth " << result.depth << " score ";
+    if (isMateScore(result.score)) {
+        // Moves, not plies, and negative when the side to move is the one being mated
+        const int plies = MATE_SCORE - std::abs(result.score);
+        std::cout << "mate " << (result.score > 0 ? (plies + 1) / 2 : -(plies / 2));
+    } else {
+        std::cout << "cp " << result.score;
+    }
+    const double nps = result.seconds > 0.0 ? static_cast<double>(result.nodes) / result.seconds : 0.0;
+    std::cout << " nodes " << result.nodes << " time " << static_cast<int64_t>(result.seconds * 1000.0) << " ms nps "
+              << static_cast<uint64_t>(nps) << " pv";
+
+    GameData g = root;
+    for (const uint16_t move : result.pv) {
+        char san[MAX_SAN_LENGTH];
+        moveToSAN(g, move, san);
+        std::cout << " " << san;
+        makeMove(g, move, g.state.isWhiteTurn);
+    }
+    std::cout << "\n";
+}
+
+static int search(const char* fen, SearchLimits limits) {
+    GameData g;
+    if (!loadPosition(fen, g)) return 1;
+    if (limits.depth == 0 && limits.nodes == 0 && limits.timeMs == 0) limits.depth = 8;
+
+    GameHistory history;
+    history.reset(g);
+    chessengine engine;
+    const SearchResult result = engine.search(g, history, limits, [&](const SearchResult& iteration) {
+        printIteration(g, iteration);
+    });
+
+    if (isInvalidMove(result.bestMove)) {
+        std::cout << "No legal moves\n";
+        return 0;
+    }
+    char san[MAX_SAN_LENGTH];
+    moveToSAN(g, result.bestMove, san);
+    const double nps = result.seconds > 0.0 ? static_cast<double>(result.nodes) / result.seconds : 0.0;
+    std::cout << "Best move: " << san << "\n"
+              << "Nodes: " << result.nodes << " in " << result.seconds * 1000.0 << " ms ("
+              << nps / 1e6 << " Mnps)\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    setup();
+
+    int threads = 1;
+    size_t chunkBytes = DEFAULT_PGN_CHUNK_BYTES;
+    ExplorerOptions explorerOptions;
+    BookBuildOptions bookOptions;
+    SearchLimits searchLimits;
+    std::vector<const char*> args;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+            chunkBytes = static_cast<size_t>(atof(argv[++i]) * 1048576.0);
+        }
+        else if (strcmp(argv[i], "--plies") == 0 && i + 1 < argc) {
+            explorerOptions.maxPlies = bookOptions.maxPlies = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--min-games") == 0 && i + 1 < argc) {
+            explorerOptions.minGames = bookOptions.minGames = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--points") == 0 && i + 1 < argc) {
+            unsigned win, draw, loss;
+            if (sscanf(argv[++i], "%u,%u,%u", &win, &draw, &loss) == 3) {
+                bookOptions.winPoints = win;
+                bookOptions.drawPoints = draw;
+                bookOptions.lossPoints = loss;
+            }
+        }
+        else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+            bookOptions.memoryLimitMB = static_cast<size_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            searchLimits.depth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+            searchLimits.nodes = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--movetime") == 0 && i + 1 < argc) {
+            searchLimits.timeMs = atoll(argv[++i]);
+        }
+        else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads <= 0) threads = 1;
+    }
+    explorerOptions.threads = bookOptions.threads = threads;
+
+    if (args.size() >= 2 && strcmp(args[0], "pgn-stats") == 0) {
+        return pgnStats(args[1], threads, chunkBytes);
+    }
+    if (args.size() >= 3 && strcmp(args[0], "pgn-to-db") == 0) {
+        return pgnToDb(args[1], args[2]);
+    }
+    if (args.size() >= 2 && strcmp(args[0], "db-stats") == 0) {
+        return dbStats(args[1]);
+    }
+    if (args.size() >= 3 && strcmp(args[0], "explorer-build") == 0) {
+        return explorerBuild(args[1], args[2], explorerOptions);
+    }
+    if (args.size() >= 2 && strcmp(args[0], "explorer") == 0) {
+        return explorerQuery(args[1], args.size() >= 3 ? args[2] : nullptr);
+    }
+    if (args.size() >= 2 && strcmp(args[0], "book") == 0) {
+        return bookQuery(args[1], args.size() >= 3 ? args[2] : nullptr);
+    }
+    if (args.size() >= 3 && strcmp(args[0], "book-build") == 0) {
+        return bookBuild(args[1], args[2], bookOptions);
+    }
+    if (args.size() >= 1 && strcmp(args[0], "search") == 0) {
+        return search(args.size() >= 2 ? args[1] : nullptr, searchLimits);
+    }
+
+    std::cout << "Usage:\n"
+              << "  chesstool [--threads N] [--chunk MB] pgn-stats <file.pgn>\n"
+              << "  chesstool pgn-to-db <file.pgn> <file.gdb>\n"
+              << "  chesstool db-stats <file.gdb>\n"
+              << "  chesstool [--threads N] [--plies P] [--min-games G] explorer-build <file.gdb> <file.idx>\n"
+              << "  chesstool explorer <file.idx> [fen]\n"
+              << "  chesstool book <file.bin> [fen]\n"
+              << "  chesstool [--threads N] [--plies P] [--min-games G] [--points W,D,L] [--memory MB]\n"
+              << "            book-build <file.gdb|file.pgn> <file.bin>\n"
+              << "  chesstool [--depth D] [--nodes N] [--movetime MS] search [fen]\n";
+    return 1;
+}
@@ -0,0 +1,231 @@
+#include "explorer.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~ Building ~~~~~~~~~~~~~~~~
+
+namespace {
+    // Everything known about the games that played one move from one position
+    struct MoveTally {
+        uint64_t key;
+        uint16_t move;
+        uint32_t games;
+        uint32_t whiteWins;
+        uint32_t draws;
+        uint32_t blackWins;
+        uint32_t ratedGames;
+        uint64_t ratingSum;
+    };
+
+    // Sorts by position and move and folds duplicate pairs together
+    void compact(std::vector<MoveTally>& tallies) {
+        std::sort(tallies.begin(), tallies.end(), [](const MoveTally& a, const MoveTally& b) {
+            return a.key != b.key ? a.key < b.key : a.move < b.move;
+        });
+        size_t count = 0;
+        for (const MoveTally& tally : tallies) {
+            if (count > 0 && tallies[count - 1].key == tally.key && tallies[count - 1].move == tally.move) {
+                MoveTally& merged = tallies[count - 1];
+                merged.games += tally.games;
+                merged.whiteWins += tally.whiteWins;
+                merged.draws += tally.draws;
+                merged.blackWins += tally.blackWins;
+                merged.ratedGames += tally.ratedGames;
+                merged.ratingSum += tally.ratingSum;
+            } else {
+                tallies[count++] = tally;
+            }
+        }
+        tallies.resize(count);
+    }
+}
+
+// A position repeated within one game counts that game once, with the move first played from it.
+// Sorting the game's own tallies keeps this O(p log p) in its plies.
+static void dedupeGame(std::vector<MoveTally>& tallies, const size_t first) {
+    const auto begin = tallies.begin() + static_cast<std::ptrdiff_t>(first);
+    std::stable_sort(begin, tallies.end(), [](const MoveTally& a, const MoveTally& b) { return a.key < b.key; });
+    tallies.erase(std::unique(begin, tallies.end(), [](const MoveTally& a, const MoveTally& b) { return a.key == b.key; }),
+                  tallies.end());
+}
+
+// Games handed to a worker at a time
+constexpr uint64_t EXPLORER_GAMES_PER_TASK = 1024;
+// A worker folds its tallies together once it holds this many, which keeps memory near the number
+// of distinct (position, move) pairs rather than the number of plies replayed
+constexpr size_t EXPLORER_COMPACT_THRESHOLD = 1 << 22;
+
+bool buildExplorerIndex(const GameDatabase& db, const char* path, const ExplorerOptions& options, ExplorerBuildStats& stats) {
+    stats = ExplorerBuildStats{};
+    const int threads = std::max(options.threads, 1);
+    struct alignas(64) Worker {
+        std::vector<MoveTally> tallies;
+        size_t compactAt = EXPLORER_COMPACT_THRESHOLD;
+        uint64_t skippedGames = 0;
+    };
+    std::vector<Worker> workers(threads);
+
+    const uint64_t taskCount = (db.gameCount() + EXPLORER_GAMES_PER_TASK - 1) / EXPLORER_GAMES_PER_TASK;
+    runWorkStealing(taskCount, threads, [&](const int self, const size_t task) {
+        Worker& worker = workers[self];
+        const uint64_t end = std::min<uint64_t>((task + 1) * EXPLORER_GAMES_PER_TASK, db.gameCount());
+        for (uint64_t game = task * EXPLORER_GAMES_PER_TASK; game < end; game++) {
+            const GameRecord& record = db.record(game);
+            MoveTally base{};
+            base.games = 1;
+            base.whiteWins = record.result == GameResult::WhiteWins;
+            base.draws = record.result == GameResult::Draw;
+            base.blackWins = record.result == GameResult::BlackWins;
+            const int ratings = (record.whiteElo != 0) + (record.blackElo != 0);
+            if (ratings) {
+                base.ratedGames = 1;
+                base.ratingSum = (record.whiteElo + record.blackElo) / ratings;
+            }
+
+            const size_t mark = worker.tallies.size();
+            const bool replayed = db.replay(game, [&](const GameData& position, const uint16_t move) {
+                MoveTally tally = base;
+                tally.key = position.state.hash;
+                tally.move = move;
+                worker.tallies.push_back(tally);
+            }, options.maxPlies);
+            // A game that stops replaying part way is left out entirely
+            if (!replayed) {
+                worker.tallies.resize(mark);
+                worker.skippedGames++;
+            } else {
+                dedupeGame(worker.tallies, mark);
+            }
+
+            if (worker.tallies.size() >= worker.compactAt) {
+                compact(worker.tallies);
+                worker.compactAt = std::max(EXPLORER_COMPACT_THRESHOLD, worker.tallies.size() * 2);
+            }
+        }
+    });
+
+    for (const Worker& worker : workers) {
+        stats.skippedGames += worker.skippedGames;
+    }
+    stats.games = db.gameCount() - stats.skippedGames;
+
+    std::vector<MoveTally> tallies = std::move(workers[0].tallies);
+    for (int i = 1; i < threads; i++) {
+        tallies.insert(tallies.end(), workers[i].tallies.begin(), workers[i].tallies.end());
+        std::vector<MoveTally>().swap(workers[i].tallies);
+    }
+    compact(tallies);
+
+    // Tallies are now grouped by position; fold each group into a position and its top moves
+    std::vector<ExplorerPosition> positions;
+    std::vector<ExplorerMove> moves;
+    for (size_t first = 0; first < tallies.size();) {
+        size_t last = first;
+        ExplorerPosition position{};
+        uint32_t ratedGames = 0;
+        uint64_t ratingSum = 0;
+        position.key = tallies[first].key;
+        for (; last < tallies.size() && tallies[last].key == position.key; last++) {
+            position.games += tallies[last].games;
+            position.whiteWins += tallies[last].whiteWins;
+            position.draws += tallies[last].draws;
+            position.blackWins += tallies[last].blackWins;
+            ratedGames += tallies[last].ratedGames;
+            ratingSum += tallies[last].ratingSum;
+        }
+        if (position.games < options.minGames) {
+            first = last;
+            continue;
+        }
+        position.averageRating = ratedGames ? static_cast<uint16_t>(ratingSum / ratedGames) : 0;
+
+        const size_t kept = std::min<size_t>(last - first, MAX_EXPLORER_MOVES);
+        std::partial_sort(tallies.begin() + first, tallies.begin() + first + kept, tallies.begin() + last,
+                          [](const MoveTally& a, const MoveTally& b) {
+                              return a.games != b.games ? a.games > b.games : a.move < b.move;
+                          });
+        position.moveCount = static_cast<uint16_t>(kept);
+        position.firstMove = static_cast<uint32_t>(moves.size());
+        for (size_t i = first; i < first + kept; i++) {
+            moves.push_back({tallies[i].move, 0, tallies[i].games, tallies[i].whiteWins, tallies[i].draws, tallies[i].blackWins});
+        }
+        positions.push_back(position);
+        first = last;
+    }
+
+    stats.positions = positions.size();
+    ExplorerHeader header{};
+    std::memcpy(header.magic, EXPLORER_MAGIC, sizeof(header.magic));
+    header.version = EXPLORER_VERSION;
+    header.maxPlies = static_cast<uint32_t>(options.maxPlies);
+    header.positionCount = positions.size();
+    header.moveCount = moves.size();
+    header.positionsOffset = sizeof(ExplorerHeader);
+    header.movesOffset = header.positionsOffset + positions.size() * sizeof(ExplorerPosition);
+
+    std::FILE* out = std::fopen(path, "wb");
+    if (!out) return false;
+    bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && (positions.empty() || std::fwrite(positions.data(), sizeof(ExplorerPosition), positions.size(), out) == positions.size());
+    ok = ok && (moves.empty() || std::fwrite(moves.data(), sizeof(ExplorerMove), moves.size(), out) == moves.size());
+    ok = std::fclose(out) == 0 && ok;
+    return ok;
+}
+
+// ~~~~~~~~~~~~~~~~ Lookup ~~~~~~~~~~~~~~~~
+
+constexpr int EXPLORER_INTERPOLATION_PROBES = 8;
+
+bool OpeningExplorer::open(const char* path) {
+    header = nullptr;
+    if (!file.open(path, FileAccess::Random) || file.size() < sizeof(ExplorerHeader)) return false;
+
+    const auto* candidate = reinterpret_cast<const ExplorerHeader*>(file.data());
+    const uint64_t size = file.size();
+    if (std::memcmp(candidate->magic, EXPLORER_MAGIC, sizeof(candidate->magic)) != 0 ||
+        candidate->version != EXPLORER_VERSION) {
+        return false;
+    }
+    if (candidate->positionsOffset != sizeof(ExplorerHeader) || candidate->positionCount > size / sizeof(ExplorerPosition) ||
+        candidate->moveCount > size / sizeof(ExplorerMove) ||
+        candidate->movesOffset != candidate->positionsOffset + candidate->positionCount * sizeof(ExplorerPosition) ||
+        candidate->movesOffset + candidate->moveCount * sizeof(ExplorerMove) > size) {
+        return false;
+    }
+
+    header = candidate;
+    positions = reinterpret_cast<const ExplorerPosition*>(file.data() + header->positionsOffset);
+    movesBase = reinterpret_cast<const ExplorerMove*>(file.data() + header->movesOffset);
+    return true;
+}
+
+const ExplorerPosition* OpeningExplorer::find(const uint64_t key) const {
+    if (!header) return nullptr;
+
+    // Zobrist keys are spread uniformly, so interpolating on the key lands next to the target and
+    // takes O(log log n) probes. The last few entries are left to a binary search, as is everything
+    // after EXPLORER_INTERPOLATION_PROBES, so skewed keys cannot turn the search linear.
+    uint64_t low = 0;
+    uint64_t high = header->positionCount;
+    for (int probes = 0; probes < EXPLORER_INTERPOLATION_PROBES && high - low > 16; probes++) {
+        const uint64_t lowKey = positions[low].key;
+        const uint64_t highKey = positions[high - 1].key;
+        if (key < lowKey || key > highKey) return nullptr;
+
+        const double fraction = static_cast<double>(key - lowKey) / static_cast<double>(highKey - lowKey);
+        uint64_t probe = low + static_cast<uint64_t>(fraction * static_cast<double>(high - 1 - low));
+        probe = std::min(std::max(probe, low), high - 1);
+        if (positions[probe].key == key) return &positions[probe];
+        if (positions[probe].key < key) low = probe + 1;
+        else high = probe;
+    }
+
+    const ExplorerPosition* found = std::lower_bound(positions + low, positions + high, key,
+        [](const ExplorerPosition& position, const uint64_t target) { return position.key < target; });
+    return found != positions + high && found->key == key ? found : nullptr;
+}
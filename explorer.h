@@ -0,0 +1,96 @@
+#pragma once
+
+#include "gamedb.h"
+#include "mappedfile.h"
+
+#include <cstdint>
+
+// ~~~~~~~~~~~~~~~~ Opening explorer index format ~~~~~~~~~~~~~~~~
+// An explorer file is laid out as
+//   ExplorerHeader | ExplorerPosition x positionCount | ExplorerMove x moveCount
+// in native (little-endian) byte order. Positions are sorted by their Zobrist hash (GameState::hash),
+// and each points at its most played continuations, stored most played first.
+
+constexpr char EXPLORER_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'E', 'X', 'P'};
+// Version 2: keys only include the en passant file when the capture is possible (see epInHash())
+constexpr uint32_t EXPLORER_VERSION = 2;
+// Continuations kept per position; the position totals still count every move
+constexpr int MAX_EXPLORER_MOVES = 8;
+
+struct ExplorerHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t maxPlies;
+    uint64_t positionCount;
+    uint64_t moveCount;
+    uint64_t positionsOffset;
+    uint64_t movesOffset;
+};
+static_assert(sizeof(ExplorerHeader) == 48);
+
+struct ExplorerMove {
+    uint16_t move;
+    uint16_t reserved;
+    uint32_t games;
+    uint32_t whiteWins;
+    uint32_t draws;
+    uint32_t blackWins;
+};
+static_assert(sizeof(ExplorerMove) == 20);
+
+struct ExplorerPosition {
+    uint64_t key;
+    uint32_t games;
+    uint32_t whiteWins;
+    uint32_t draws;
+    uint32_t blackWins;
+    // Mean of the players' ratings over the games that had any; 0 when none did
+    uint16_t averageRating;
+    uint16_t moveCount;
+    // Index of the first continuation in the move array
+    uint32_t firstMove;
+};
+static_assert(sizeof(ExplorerPosition) == 32);
+
+// ~~~~~~~~~~~~~~~~ Building ~~~~~~~~~~~~~~~~
+
+struct ExplorerOptions {
+    // Positions after this many plies from the start of a game are not indexed
+    int maxPlies = 30;
+    // Positions reached in fewer games are left out of the index
+    uint32_t minGames = 1;
+    int threads = 1;
+};
+
+struct ExplorerBuildStats {
+    uint64_t games = 0;
+    // Games whose moves did not replay (a damaged database); none of their positions are indexed
+    uint64_t skippedGames = 0;
+    uint64_t positions = 0;
+};
+
+// Replays every game in db on options.threads workers and writes the index to path. A position
+// repeated within one game counts that game once.
+bool buildExplorerIndex(const GameDatabase& db, const char* path, const ExplorerOptions& options, ExplorerBuildStats& stats);
+
+// ~~~~~~~~~~~~~~~~ Lookup ~~~~~~~~~~~~~~~~
+
+class OpeningExplorer {
+public:
+    // Maps path and checks its header and section bounds
+    bool open(const char* path);
+
+    uint64_t positionCount() const { return header ? header->positionCount : 0; }
+    int maxPlies() const { return header ? static_cast<int>(header->maxPlies) : 0; }
+
+    // Statistics for the position with this hash, or nullptr if it was not indexed
+    const ExplorerPosition* find(uint64_t key) const;
+    // The position's continuations, most played first; position.moveCount of them
+    const ExplorerMove* moves(const ExplorerPosition& position) const { return movesBase + position.firstMove; }
+
+private:
+    MappedFile file;
+    const ExplorerHeader* header = nullptr;
+    const ExplorerPosition* positions = nullptr;
+    const ExplorerMove* movesBase = nullptr;
+};
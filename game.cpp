@@ -1,96 +1,302 @@
 #include "game.h"
 
+#include <algorithm>
+#include <charconv>
 #include <cassert>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 
 // ~~~~~~~~~~~~~~~~ Board Setup and Game Cycle Section ~~~~~~~~~~~~~~~~
 
-FileMasks files;
-RankMasks ranks;
-GameData game;
-
-void setupFiles() {
-    files.A_FILE = 0x0101010101010101ULL;
-    files.B_FILE = 0x0202020202020202ULL;
-    files.C_FILE = 0x0404040404040404ULL;
-    files.D_FILE = 0x0808080808080808ULL;
-    files.E_FILE = 0x1010101010101010ULL;
-    files.F_FILE = 0x2020202020202020ULL;
-    files.G_FILE = 0x4040404040404040ULL;
-    files.H_FILE = 0x8080808080808080ULL;
-}
-void setupRanks() {
-    ranks.FIRST_RANK   = 0x00000000000000FFULL;
-    ranks.SECOND_RANK  = 0x000000000000FF00ULL;
-    ranks.THIRD_RANK   = 0x0000000000FF0000ULL;
-    ranks.FOURTH_RANK  = 0x00000000FF000000ULL;
-    ranks.FIFTH_RANK   = 0x000000FF00000000ULL;
-    ranks.SIXTH_RANK   = 0x0000FF0000000000ULL;
-    ranks.SEVENTH_RANK = 0x00FF000000000000ULL;
-    ranks.EIGHTH_RANK  = 0xFF00000000000000ULL;
-}
-void setupStartingPosition() {
-    game.boards.wPawns   = 0x000000000000FF00ULL;
-    game.boards.bPawns   = 0x00FF000000000000ULL;
-    game.boards.wKnights = 0x0000000000000042ULL;
-    game.boards.bKnights = 0x4200000000000000ULL;
-    game.boards.wRooks   = 0x0000000000000081ULL;
-    game.boards.bRooks   = 0x8100000000000000ULL;
-    game.boards.wBishops = 0x0000000000000024ULL;
-    game.boards.bBishops = 0x2400000000000000ULL;
-    game.boards.wQueens  = 0x0000000000000008ULL;
-    game.boards.bQueens  = 0x0800000000000000ULL;
-    game.boards.wKing    = 0x0000000000000010ULL;
-    game.boards.bKing    = 0x1000000000000000ULL;
-    game.boards.wPieces  = 0x000000000000FFFFULL;
-    game.boards.bPieces  = 0xFFFF000000000000ULL;
-}
-void setupState() {
-    game.state.isWhiteTurn = true;
-    game.state.epSquare = -1;
-    game.state.moveCounter = 0;
-    game.state.castling = 0b1111;
+void setupStartingPosition(GameData& g) {
+    // Piece order: pawns, knights, bishops, rooks, queens, king
+    constexpr uint64_t whiteStart[NUM_PIECE_TYPES] = {
+        0x000000000000FF00ULL, 0x0000000000000042ULL, 0x0000000000000024ULL,
+        0x0000000000000081ULL, 0x0000000000000008ULL, 0x0000000000000010ULL
+    };
+    for (int type = 0; type < NUM_PIECE_TYPES; type++) {
+        g.boards.pieces[WHITE][type] = whiteStart[type];
+        // Black mirrors white vertically
+        g.boards.pieces[BLACK][type] = __builtin_bswap64(whiteStart[type]);
+    }
+    g.boards.occupancy[WHITE] = 0x000000000000FFFFULL;
+    g.boards.occupancy[BLACK] = 0xFFFF000000000000ULL;
+    g.boards.rebuildMailbox();
+}
+void setupState(GameData& g) {
+    g.state.isWhiteTurn = true;
+    g.state.epSquare = -1;
+    g.state.moveCounter = 0;
+    g.state.castling = 0b1111;
+    g.state.fullmoveNumber = 1;
+    g.state.hash = computeHash(g);
+}
+// Sets g to the starting position and starts history from it
+void setupNewGame(GameData& g, GameHistory& history) {
+    setupStartingPosition(g);
+    setupState(g);
+    history.reset(g);
 }
+// Process-wide initialisation; every GameData shares the read-only tables afterwards
 void setup() {
-    setupFiles();
-    setupRanks();
-    setupStartingPosition();
-    setupState();
     MoveTables::init();
+    MoveTables::printDiagnostics();
+}
+// ~~~~ FEN/EPD ~~~~
+// Parsing works on string_views into the caller's text and writes straight into g, so loading a
+// position never allocates.
+
+// Splits the next whitespace-separated field off the front of text (empty when none is left)
+static std::string_view nextField(std::string_view& text) {
+    const size_t start = text.find_first_not_of(" \t\r\n");
+    if (start == std::string_view::npos) {
+        text = {};
+        return {};
+    }
+    text.remove_prefix(start);
+    const size_t end = std::min(text.find_first_of(" \t\r\n"), text.size());
+    const std::string_view field = text.substr(0, end);
+    text.remove_prefix(end);
+    return field;
+}
+
+static bool parseCount(const std::string_view field, int& value) {
+    const auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+    return error == std::errc() && end == field.data() + field.size() && value >= 0;
+}
+
+static uint8_t pieceFromChar(const char c) {
+    switch (c) {
+        case 'P': return makePiece(true, PieceType::Pawn);
+        case 'N': return makePiece(true, PieceType::Knight);
+        case 'B': return makePiece(true, PieceType::Bishop);
+        case 'R': return makePiece(true, PieceType::Rook);
+        case 'Q': return makePiece(true, PieceType::Queen);
+        case 'K': return makePiece(true, PieceType::King);
+        case 'p': return makePiece(false, PieceType::Pawn);
+        case 'n': return makePiece(false, PieceType::Knight);
+        case 'b': return makePiece(false, PieceType::Bishop);
+        case 'r': return makePiece(false, PieceType::Rook);
+        case 'q': return makePiece(false, PieceType::Queen);
+        case 'k': return makePiece(false, PieceType::King);
+        default: return NO_PIECE;
+    }
+}
+
+// Parses the four fields FEN and EPD share (placement, side, castling, en passant), consuming them from text.
+// Counters are reset to their defaults and the hash is left for the caller to compute.
+static bool parsePositionFields(std::string_view& text, GameData& g) {
+    const std::string_view placement = nextField(text);
+    const std::string_view side = nextField(text);
+    const std::string_view castling = nextField(text);
+    const std::string_view ep = nextField(text);
+    if (ep.empty()) return false;
+
+    g.boards = BitBoards{};
+    std::fill(std::begin(g.boards.pieceOn), std::end(g.boards.pieceOn), NO_PIECE);
+    int rank = 7;
+    int file = 0;
+    for (const char c : placement) {
+        if (c == '/') {
+            if (file != 8 || rank == 0) return false;
+            rank--;
+            file = 0;
+            continue;
+        }
+        if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > 8) return false;
+            continue;
+        }
+        const uint8_t piece = pieceFromChar(c);
+        if (piece == NO_PIECE || file >= 8) return false;
+        g.boards.addPiece(rank * 8 + file, piece);
+        file++;
+    }
+    if (rank != 0 || file != 8) return false;
+    // Move generation and check detection assume exactly one king per side
+    if (__builtin_popcountll(g.boards.wKing()) != 1 || __builtin_popcountll(g.boards.bKing()) != 1) return false;
+
+    if (side != "w" && side != "b") return false;
+    g.state.isWhiteTurn = side == "w";
+
+    g.state.castling = 0;
+    if (castling != "-") {
+        for (const char c : castling) {
+            switch (c) {
+                case 'K': g.state.castling |= CASTLE_WK; break;
+                case 'Q': g.state.castling |= CASTLE_WQ; break;
+                case 'k': g.state.castling |= CASTLE_BK; break;
+                case 'q': g.state.castling |= CASTLE_BQ; break;
+                default: return false;
+            }
+        }
+        // A right whose king or rook is not on its home square could never be used, so it is dropped
+        g.state.castling &= castlingRightsOnBoard(g.boards);
+    }
+
+    g.state.epSquare = -1;
+    if (ep != "-") {
+        g.state.epSquare = coordsToNum(ep);
+        // The ep square is always behind a pawn that just double-moved
+        if (getRank(g.state.epSquare) != (g.state.isWhiteTurn ? 5 : 2)) return false;
+        // That pawn must still be there, with the squares it crossed empty; otherwise the capture
+        // would remove a piece that is not on the board, so the square is dropped
+        const int pushed = g.state.isWhiteTurn ? g.state.epSquare - 8 : g.state.epSquare + 8;
+        const int origin = g.state.isWhiteTurn ? g.state.epSquare + 8 : g.state.epSquare - 8;
+        if (g.boards.pieceOn[pushed] != makePiece(!g.state.isWhiteTurn, PieceType::Pawn) ||
+            g.boards.pieceOn[g.state.epSquare] != NO_PIECE || g.boards.pieceOn[origin] != NO_PIECE) {
+            g.state.epSquare = -1;
+        }
+    }
+
+    // The side that just moved cannot have left its own king in check
+    const int waitingKing = lsb(g.state.isWhiteTurn ? g.boards.bKing() : g.boards.wKing());
+    if (isSquareAttacked(waitingKing, g.state.isWhiteTurn, g.boards)) return false;
+
+    g.state.moveCounter = 0;
+    g.state.fullmoveNumber = 1;
+    return true;
+}
+
+// Sets g to the position described by a FEN string. The halfmove and fullmove fields are optional.
+// Returns false (leaving g unspecified) if it is malformed.
+bool loadFEN(std::string_view fen, GameData& g) {
+    if (!parsePositionFields(fen, g)) return false;
+
+    const std::string_view halfMoves = nextField(fen);
+    if (!halfMoves.empty() && !parseCount(halfMoves, g.state.moveCounter)) return false;
+    const std::string_view fullMoves = nextField(fen);
+    if (!fullMoves.empty() && (!parseCount(fullMoves, g.state.fullmoveNumber) || g.state.fullmoveNumber == 0)) return false;
+
+    g.state.hash = computeHash(g);
+    return true;
+}
+
+// Sets g from an EPD record and splits its operations into ops. The views in ops point into epd.
+// The hmvc and fmvn opcodes, when present, set the move counters.
+bool loadEPD(std::string_view epd, GameData& g, EpdOperations& ops) {
+    ops.count = 0;
+    if (!parsePositionFields(epd, g)) return false;
+
+    while (true) {
+        const size_t start = epd.find_first_not_of(" \t\r\n");
+        if (start == std::string_view::npos) break;
+        epd.remove_prefix(start);
+
+        // Operands run to the next semicolon outside a quoted string
+        const size_t opcodeEnd = std::min(epd.find_first_of(" \t;"), epd.size());
+        size_t end = opcodeEnd;
+        bool quoted = false;
+        while (end < epd.size() && (quoted || epd[end] != ';')) {
+            if (epd[end] == '"') quoted = !quoted;
+            end++;
+        }
+        if (quoted || ops.count == MAX_EPD_OPERATIONS) return false;
+
+        EpdOperation& op = ops.ops[ops.count++];
+        op.opcode = epd.substr(0, opcodeEnd);
+        op.operands = epd.substr(opcodeEnd, end - opcodeEnd);
+        const size_t first = op.operands.find_first_not_of(" \t");
+        op.operands = first == std::string_view::npos ? std::string_view() : op.operands.substr(first, op.operands.find_last_not_of(" \t") - first + 1);
+        epd.remove_prefix(std::min(end + 1, epd.size()));
+
+        if (op.opcode == "hmvc" && !parseCount(op.operands, g.state.moveCounter)) return false;
+        if (op.opcode == "fmvn" && (!parseCount(op.operands, g.state.fullmoveNumber) || g.state.fullmoveNumber == 0)) return false;
+    }
+
+    g.state.hash = computeHash(g);
+    return true;
+}
+
+const EpdOperation* EpdOperations::find(const std::string_view opcode) const {
+    for (int i = 0; i < count; i++) {
+        if (ops[i].opcode == opcode) return &ops[i];
+    }
+    return nullptr;
+}
+
+// Writes the FEN string of g into buf (at least MAX_FEN_LENGTH chars) and null-terminates it.
+// Returns the length, excluding the terminator.
+int toFEN(const GameData& g, char* buf) {
+    char* out = buf;
+    for (int rank = 7; rank >= 0; rank--) {
+        int empty = 0;
+        for (int file = 0; file < 8; file++) {
+            const uint8_t piece = g.boards.pieceOn[rank * 8 + file];
+            if (piece == NO_PIECE) {
+                empty++;
+                continue;
+            }
+            if (empty) *out++ = static_cast<char>('0' + empty);
+            empty = 0;
+            *out++ = "PNBRQKpnbrqk"[piece];
+        }
+        if (empty) *out++ = static_cast<char>('0' + empty);
+        if (rank) *out++ = '/';
+    }
+
+    *out++ = ' ';
+    *out++ = g.state.isWhiteTurn ? 'w' : 'b';
+
+    *out++ = ' ';
+    if (!g.state.castling) *out++ = '-';
+    if (g.state.castling & CASTLE_WK) *out++ = 'K';
+    if (g.state.castling & CASTLE_WQ) *out++ = 'Q';
+    if (g.state.castling & CASTLE_BK) *out++ = 'k';
+    if (g.state.castling & CASTLE_BQ) *out++ = 'q';
+
+    *out++ = ' ';
+    if (g.state.epSquare == -1) {
+        *out++ = '-';
+    } else {
+        *out++ = static_cast<char>('a' + getFile(g.state.epSquare));
+        *out++ = static_cast<char>('1' + getRank(g.state.epSquare));
+    }
+
+    *out++ = ' ';
+    out = std::to_chars(out, buf + MAX_FEN_LENGTH, g.state.moveCounter).ptr;
+    *out++ = ' ';
+    out = std::to_chars(out, buf + MAX_FEN_LENGTH, g.state.fullmoveNumber).ptr;
+    *out = '\0';
+    return static_cast<int>(out - buf);
 }
-void printBoard() {
+
+void printBoard(const GameData& g) {
     for (int rank = 7; rank >= 0; rank--) {
         std::cout << (rank + 1) << " | ";
         for (int file = 0; file < 8; file++) {
             int square = rank * 8 + file;
-            std::cout << getPieceAt(square) << " ";
+            std::cout << getPieceAt(g, square) << " ";
         }
         std::cout << "\n";
     }
     std::cout << "    _ _ _ _ _ _ _ _\n";
     std::cout << "    a b c d e f g h\n";
 
-    std::cout << (game.state.isWhiteTurn ? "White" : "Black") << " to move.\n";
+    std::cout << (g.state.isWhiteTurn ? "White" : "Black") << " to move.\n";
 }
 [[noreturn]] void runInConsole() {
     setup();
+    GameData g;
+    GameHistory history;
+    setupNewGame(g, history);
     while (true) {
         std::string moveStr;
 
         bool successful = false;
         while (!successful) {
-            printBoard();
+            printBoard(g);
             std::cout << "Enter move (e.g. e4, Nf3, Qxe5): ";
             std::cin >> moveStr;
-            uint16_t nextMove = parseAlgebraicMove(moveStr, game.state.isWhiteTurn);
+            uint16_t nextMove = parseSAN(g, moveStr);
             if (isInvalidMove(nextMove)) {
-                std::cout << "ERR: parseAlgebraicMove() returned INVALID_MOVE.\n";
+                std::cout << "ERR: parseSAN() returned INVALID_MOVE.\n";
                 continue;
             }
-            successful = move(nextMove, game.state.isWhiteTurn);
+            successful = move(g, history, nextMove, g.state.isWhiteTurn);
         }
-        game.state.isWhiteTurn = !game.state.isWhiteTurn;
     }
 }
 
@@ -98,45 +304,19 @@ void printBoard() {
 
 // Checks if the piece on startSquare can move to endSquare (considers player turn,
 // piece movement path validity, and ending location, but not king checks
-bool isValidMove(const uint16_t nextMove, const bool isWhiteTurn) {
+bool isValidMove(const GameData& g, const uint16_t nextMove, const bool isWhiteTurn) {
     int startSquare = getStart(nextMove);
     int endSquare = getEnd(nextMove);
     uint64_t startMask = mask(startSquare);
     uint64_t endMask = mask(endSquare);
 
-    // If white didn't select a white piece
-    if (isWhiteTurn && !(startMask & game.boards.wPieces)) {
-        return false;
-    }
-    // If black didn't select a black piece
-    if (!isWhiteTurn && !(startMask & game.boards.bPieces)) {
+    // The mover must select one of their own pieces and not land on another
+    const uint64_t ownPieces = g.boards.occupancy[colorOf(isWhiteTurn)];
+    if (!(startMask & ownPieces) || (endMask & ownPieces)) {
         return false;
     }
-    // If white is moving onto a white piece
-    if (isWhiteTurn && (endMask & game.boards.wPieces)) {
-        return false;
-    }
-    // If black is moving onto a black piece
-    if (!isWhiteTurn && (endMask & game.boards.bPieces)) {
-        return false;
-    }
-
-    PieceType pieceType = PieceType::None;
-    uint64_t* bitboards[6] = {
-        isWhiteTurn ? &game.boards.wPawns   : &game.boards.bPawns,
-        isWhiteTurn ? &game.boards.wKnights : &game.boards.bKnights,
-        isWhiteTurn ? &game.boards.wBishops : &game.boards.bBishops,
-        isWhiteTurn ? &game.boards.wRooks   : &game.boards.bRooks,
-        isWhiteTurn ? &game.boards.wQueens  : &game.boards.bQueens,
-        isWhiteTurn ? &game.boards.wKing    : &game.boards.bKing
-    };
 
-    for (int i = 0; i < NUM_PIECE_TYPES; ++i) {
-        if (*bitboards[i] & startMask) {
-            pieceType = static_cast<PieceType>(i);
-            break;
-        }
-    }
+    const PieceType pieceType = pieceTypeOf(g.boards.pieceOn[startSquare]);
 
     if (pieceType == PieceType::None) {
         std::cout << "Error: couldn't determine piece type.\n";
@@ -144,35 +324,36 @@ bool isValidMove(const uint16_t nextMove, const bool isWhiteTurn) {
     }
 
     // Castling
-    uint64_t occupied = game.boards.wPieces | game.boards.bPieces;
+    uint64_t occupied = g.boards.occupied();
     if (pieceType == PieceType::King && abs(endSquare - startSquare) == 2) {
+        const int rights = g.state.castling & castlingRightsOnBoard(g.boards);
         // White
-        if (startSquare == 4 && endSquare == 6 && (game.state.castling & CASTLE_WK)) {
+        if (startSquare == 4 && endSquare == 6 && (rights & CASTLE_WK)) {
             return !(mask(5) & occupied) && !(mask(6) & occupied);
         }
-        if (startSquare == 4 && endSquare == 2 && (game.state.castling & CASTLE_WQ)) {
+        if (startSquare == 4 && endSquare == 2 && (rights & CASTLE_WQ)) {
             return !(mask(3) & occupied) && !(mask(2) & occupied) && !(mask(1) & occupied);
         }
         // Black
-        if (startSquare == 60 && endSquare == 62 && (game.state.castling & CASTLE_BK)) {
+        if (startSquare == 60 && endSquare == 62 && (rights & CASTLE_BK)) {
             return !(mask(61) & occupied) && !(mask(62) & occupied);
         }
-        if (startSquare == 60 && endSquare == 58 && (game.state.castling & CASTLE_BQ)) {
+        if (startSquare == 60 && endSquare == 58 && (rights & CASTLE_BQ)) {
             return !(mask(59) & occupied) && !(mask(58) & occupied) && !(mask(57) & occupied);
         }
     }
 
-    return followsPieceMovementRules(pieceType, nextMove, isWhiteTurn);
+    return followsPieceMovementRules(g, pieceType, nextMove, isWhiteTurn);
 }
 
-bool followsPieceMovementRules(const PieceType pieceType, const uint16_t nextMove, const bool isWhiteTurn) {
+bool followsPieceMovementRules(const GameData& g, const PieceType pieceType, const uint16_t nextMove, const bool isWhiteTurn) {
     int startSquare = getStart(nextMove);
     int endSquare = getEnd(nextMove);
     switch (pieceType) {
         case PieceType::Pawn: {
             uint64_t startMask = mask(startSquare);
             uint64_t endMask = mask(endSquare);
-            uint64_t occupied = game.boards.wPieces | game.boards.bPieces;
+            uint64_t occupied = g.boards.occupied();
 
             // Standard move
             if (isWhiteTurn) {
@@ -201,25 +382,25 @@ bool followsPieceMovementRules(const PieceType pieceType, const uint16_t nextMov
             }
 
             // Capture
-            uint64_t opponentPieces = isWhiteTurn ? game.boards.bPieces : game.boards.wPieces;
+            uint64_t opponentPieces = g.boards.occupancy[colorOf(!isWhiteTurn)];
             if (isWhiteTurn) {
                 // Left
                 if ((startMask & ~files.A_FILE) && (endMask == startMask << 7)) {
-                    return endMask & opponentPieces || endSquare == game.state.epSquare;
+                    return endMask & opponentPieces || endSquare == g.state.epSquare;
                 }
                 // Right
                 if ((startMask & ~files.H_FILE) && (endMask == startMask << 9)) {
-                    return endMask & opponentPieces || endSquare == game.state.epSquare;
+                    return endMask & opponentPieces || endSquare == g.state.epSquare;
                 }
             }
             else {
                 // Left
                 if ((startMask & ~files.A_FILE) && (endMask == startMask >> 9)) {
-                    return endMask & opponentPieces || endSquare == game.state.epSquare;
+                    return endMask & opponentPieces || endSquare == g.state.epSquare;
                 }
                 // Right
                 if ((startMask & ~files.H_FILE) && (endMask == startMask >> 7)) {
-                    return endMask & opponentPieces || endSquare == game.state.epSquare;
+                    return endMask & opponentPieces || endSquare == g.state.epSquare;
                 }
             }
 
@@ -229,43 +410,16 @@ bool followsPieceMovementRules(const PieceType pieceType, const uint16_t nextMov
             return MoveTables::knightMoves[startSquare] & mask(endSquare);
         }
         case PieceType::Bishop: {
-            // Encode the blocker pattern into an index
-            int index = 0;
-            uint64_t occupied = game.boards.wPieces | game.boards.bPieces;
-            uint64_t blockerMask = MoveTables::generateBishopBlockerMask(startSquare);
-            int bitPos = 0;
-            for (int sq = 0; sq < 64; sq++) {
-                if (blockerMask & mask(sq)) {
-                    if (occupied & mask(sq)) {
-                        index |= (1 << bitPos);
-                    }
-                    bitPos++;
-                }
-            }
-
-            // Array lookup
-            return (MoveTables::bishopMoves[startSquare][index] & mask(endSquare));
+            uint64_t occupied = g.boards.occupied();
+            return MoveTables::getBishopAttacks(startSquare, occupied) & mask(endSquare);
         }
         case PieceType::Rook: {
-            // Encode the blocker pattern into an index
-            int index = 0;
-            uint64_t occupied = game.boards.wPieces | game.boards.bPieces;
-            uint64_t blockerMask = MoveTables::generateRookBlockerMask(startSquare);
-            int bitPos = 0;
-            for (int sq = 0; sq < 64; sq++) {
-                if (blockerMask & mask(sq)) {
-                    if (occupied & mask(sq)) {
-                        index |= (1 << bitPos);
-                    }
-                    bitPos++;
-                }
-            }
-            // Array lookup
-            return (MoveTables::rookMoves[startSquare][index] & mask(endSquare));
+            uint64_t occupied = g.boards.occupied();
+            return MoveTables::getRookAttacks(startSquare, occupied) & mask(endSquare);
         }
         case PieceType::Queen: {
-            return followsPieceMovementRules(PieceType::Bishop, nextMove, isWhiteTurn) ||
-                   followsPieceMovementRules(PieceType::Rook,   nextMove, isWhiteTurn);
+            uint64_t occupied = g.boards.occupied();
+            return MoveTables::getQueenAttacks(startSquare, occupied) & mask(endSquare);
         }
         case PieceType::King: {
             // Castling is handled in isValidMove()
@@ -276,135 +430,17 @@ bool followsPieceMovementRules(const PieceType pieceType, const uint16_t nextMov
 }
 
 // Move a piece from startSquare to endSquare. Calls isValidMove to check validity
-// Returns whether the move was successful or not
-bool move(const uint16_t nextMove, const bool isWhiteTurn) {
+// Returns whether the move was successful or not. On success the turn passes to the other side.
+bool move(GameData& g, GameHistory& history, const uint16_t nextMove, const bool isWhiteTurn) {
     // Check basic move validity
-    if (!isValidMove(nextMove, isWhiteTurn)) {
+    if (!isValidMove(g, nextMove, isWhiteTurn)) {
         return false;
     }
 
-    if (!isMoveLegal(nextMove, isWhiteTurn)) return false;
-
-    int startSquare    = getStart(nextMove);
-    int endSquare      = getEnd(nextMove);
-    uint64_t startMask = mask(startSquare);
-    uint64_t endMask   = mask(endSquare);
-
-    BitBoards& boards = game.boards;
-    uint64_t* myBitboards[6] = {
-        isWhiteTurn ? &boards.wPawns   : &boards.bPawns,
-        isWhiteTurn ? &boards.wKnights : &boards.bKnights,
-        isWhiteTurn ? &boards.wBishops : &boards.bBishops,
-        isWhiteTurn ? &boards.wRooks   : &boards.bRooks,
-        isWhiteTurn ? &boards.wQueens  : &boards.bQueens,
-        isWhiteTurn ? &boards.wKing    : &boards.bKing
-    };
-
-    uint64_t* theirBitboards[6] = {
-        isWhiteTurn ? &boards.bPawns   : &boards.wPawns,
-        isWhiteTurn ? &boards.bKnights : &boards.wKnights,
-        isWhiteTurn ? &boards.bBishops : &boards.wBishops,
-        isWhiteTurn ? &boards.bRooks   : &boards.wRooks,
-        isWhiteTurn ? &boards.bQueens  : &boards.wQueens,
-        isWhiteTurn ? &boards.bKing    : &boards.wKing
-    };
-
-    // Step 1: Identify which piece is moving
-    PieceType pieceType = PieceType::None;
-    for (int i = 0; i < NUM_PIECE_TYPES; i++) {
-        if (*myBitboards[i] & startMask) {
-            pieceType = static_cast<PieceType>(i);
-            break;
-        }
-    }
-
-    // Step 2: Handle capture by clearing the enemy bitboard if there's a piece at endSquare
-    uint64_t& enemyPieces = isWhiteTurn ? boards.bPieces : boards.wPieces;
-    for (uint64_t* bb : theirBitboards) {
-        if (*bb & endMask) {
-            *bb &= ~endMask;
-            enemyPieces &= ~endMask;
-            break;
-        }
-    }
-    // En Passant
-    if (pieceType == PieceType::Pawn && endSquare == game.state.epSquare) {
-        int capturedPawnSquare = isWhiteTurn ? endSquare - 8 : endSquare + 8;
-        uint64_t capturedPawnMask = mask(capturedPawnSquare);
-        (isWhiteTurn ? boards.bPawns : boards.wPawns) &= ~capturedPawnMask;
-        (isWhiteTurn ? boards.bPieces : boards.wPieces) &= ~capturedPawnMask;
-    }
-
-    // Step 3: Move the piece — clear from startSquare, set at endSquare. Handle pawn promotion.
-    int promoType = getPromo(nextMove);
-    if (pieceType == PieceType::Pawn && promoType != 0) {
-        // Remove Pawn
-        *myBitboards[static_cast<int>(pieceType)] &= ~startMask;
-        // Add the new piece
-        switch (promoType) {
-            case 1: { // Knight
-                (isWhiteTurn ? boards.wKnights : boards.bKnights) |= endMask;
-                break;
-            }
-            case 2: { // Bishop
-                (isWhiteTurn ? boards.wBishops : boards.bBishops) |= endMask;
-                break;
-            }
-            case 3: { // Rook
-                (isWhiteTurn ? boards.wRooks : boards.bRooks) |= endMask;
-                break;
-            }
-            case 4: { // Queen
-                (isWhiteTurn ? boards.wQueens : boards.bQueens) |= endMask;
-                break;
-            }
-            default: break;
-        }
-    }
-    else {
-        int pieceIdx = static_cast<int>(pieceType);
-        *myBitboards[pieceIdx] &= ~startMask;  // Remove piece from start
-        *myBitboards[pieceIdx] |=  endMask;    // Place piece at end
-    }
-
-
-    // Update wPieces or bPieces to reflect the move.
-    uint64_t& ownPieces = isWhiteTurn ? boards.wPieces : boards.bPieces;
-    ownPieces &= ~startMask;
-    ownPieces |=  endMask;
-
-    // Move the Rook if castling
-    if (pieceType == PieceType::King && abs(endSquare - startSquare) == 2) {
-        if (endSquare == 6) {  // White kingside
-            boards.wRooks &= ~mask(7);
-            boards.wRooks |= mask(5);
-            boards.wPieces &= ~mask(7);
-            boards.wPieces |= mask(5);
-        } else if (endSquare == 2) {  // White queenside
-            boards.wRooks &= ~mask(0);
-            boards.wRooks |= mask(3);
-            boards.wPieces &= ~mask(0);
-            boards.wPieces |= mask(3);
-        } else if (endSquare == 62) {  // Black kingside
-            boards.bRooks &= ~mask(63);
-            boards.bRooks |= mask(61);
-            boards.bPieces &= ~mask(63);
-            boards.bPieces |= mask(61);
-        } else if (endSquare == 58) {  // Black queenside
-            boards.bRooks &= ~mask(56);
-            boards.bRooks |= mask(59);
-            boards.bPieces &= ~mask(56);
-            boards.bPieces |= mask(59);
-        }
-    }
-
-    // Update game state data
-    updateCastlingRights(game, nextMove);
-    game.state.epSquare = -1;
-    if (pieceType == PieceType::Pawn && abs(endSquare - startSquare) == 16) {
-        game.state.epSquare = startSquare + (isWhiteTurn ? 8 : -8);
-    }
+    if (!isMoveLegal(g, nextMove, isWhiteTurn)) return false;
 
+    makeMove(g, nextMove, isWhiteTurn);
+    history.push(g.state.hash);
     return true;
 }
 
@@ -432,28 +468,12 @@ void updateCastlingRights(GameData& g, uint64_t nextMove) {
 }
 
 // Returns the piece at square (for displaying board in console)
-char getPieceAt(const int square) {
-    const uint64_t sqMask = mask(square);
-
-    if (game.boards.wPawns   & sqMask) return 'P';
-    if (game.boards.wKnights & sqMask) return 'N';
-    if (game.boards.wBishops & sqMask) return 'B';
-    if (game.boards.wRooks   & sqMask) return 'R';
-    if (game.boards.wQueens  & sqMask) return 'Q';
-    if (game.boards.wKing    & sqMask) return 'K';
-
-    if (game.boards.bPawns   & sqMask) return 'p';
-    if (game.boards.bKnights & sqMask) return 'n';
-    if (game.boards.bBishops & sqMask) return 'b';
-    if (game.boards.bRooks   & sqMask) return 'r';
-    if (game.boards.bQueens  & sqMask) return 'q';
-    if (game.boards.bKing    & sqMask) return 'k';
-
-    return '.';
+char getPieceAt(const GameData& g, const int square) {
+    return "PNBRQKpnbrqk."[g.boards.pieceOn[square]];
 }
 
 // Interprets a two-character string as a square number using algebraic notation
-int coordsToNum(const std::string& input) {
+int coordsToNum(const std::string_view input) {
     if (input.size() != 2) return -1;
     const char file = input[0];
     const char rank = input[1];
@@ -473,321 +493,462 @@ std::string squareName(const int square) {
     return std::string() + file + rank;
 }
 
-uint16_t parseAlgebraicMove(std::string input, const bool isWhiteTurn) {
-    if (input == "O-O") {
-        return isWhiteTurn ? encodeMove(4, 6, 0) : encodeMove(60, 62, 0);
-    }
-    if (input == "O-O-O") {
-        return isWhiteTurn ? encodeMove(4, 2, 0) : encodeMove(60, 58, 0);
+// Parses a SAN move ("e4", "Nbd7", "exd8=Q+", "O-O") for the side to move. The legal moves are generated
+// once and matched on piece, destination, disambiguation and promotion, so the result is always legal.
+// Returns INVALID_MOVE for malformed, illegal or ambiguous input.
+uint16_t parseSAN(const GameData& g, std::string_view san) {
+    // Check/mate markers and annotation glyphs carry no move information
+    while (!san.empty() && (san.back() == '+' || san.back() == '#' || san.back() == '!' || san.back() == '?')) {
+        san.remove_suffix(1);
+    }
+
+    MoveList moves;
+    generateLegalMoves(g, moves);
+
+    // Castling is the king moving two squares; the letter O and the digit 0 are both seen in the wild
+    const bool kingSide = san == "O-O" || san == "0-0";
+    if (kingSide || san == "O-O-O" || san == "0-0-0") {
+        const int from = g.state.isWhiteTurn ? 4 : 60;
+        const uint16_t castle = encodeMove(from, kingSide ? from + 2 : from - 2, 0);
+        for (const uint16_t move : moves) {
+            if (move == castle && pieceTypeOf(g.boards.pieceOn[from]) == PieceType::King) return move;
+        }
+        return INVALID_MOVE;
     }
 
-    // Remove trailing '+' or '#' (check or checkmate)
-    while (!input.empty() && (input.back() == '+' || input.back() == '#')) {
-        input.pop_back();
-    }
-    // Remove 'x' if it's a capture
-    if (const size_t xPos = input.find('x'); xPos != std::string::npos) {
-        input.erase(xPos, 1);
+    PieceType pieceType = PieceType::Pawn;
+    if (!san.empty()) {
+        switch (san.front()) {
+            case 'N': pieceType = PieceType::Knight; break;
+            case 'B': pieceType = PieceType::Bishop; break;
+            case 'R': pieceType = PieceType::Rook;   break;
+            case 'Q': pieceType = PieceType::Queen;  break;
+            case 'K': pieceType = PieceType::King;   break;
+            default: break;
+        }
+        if (pieceType != PieceType::Pawn) san.remove_prefix(1);
     }
 
+    // Promotion suffix, "=Q" or the older "Q"; the codes match PieceType
+    int promoType = 0;
+    if (pieceType == PieceType::Pawn && !san.empty()) {
+        switch (san.back()) {
+            case 'N': promoType = 1; break;
+            case 'B': promoType = 2; break;
+            case 'R': promoType = 3; break;
+            case 'Q': promoType = 4; break;
+            default: break;
+        }
+        if (promoType) {
+            san.remove_suffix(1);
+            if (!san.empty() && san.back() == '=') san.remove_suffix(1);
+        }
+    }
 
-    char pieceChar = 'P'; // default is pawn
+    if (san.size() < 2) return INVALID_MOVE;
+    const int endSquare = coordsToNum(san.substr(san.size() - 2));
+    if (endSquare == -1) return INVALID_MOVE;
+    san.remove_suffix(2);
+
+    // What is left is optional disambiguation followed by an optional 'x'
+    bool isCapture = false;
+    if (!san.empty() && san.back() == 'x') {
+        isCapture = true;
+        san.remove_suffix(1);
+    }
+    int fromFile = -1;
+    int fromRank = -1;
+    for (const char c : san) {
+        if (c >= 'a' && c <= 'h' && fromFile == -1 && fromRank == -1) fromFile = c - 'a';
+        else if (c >= '1' && c <= '8' && fromRank == -1) fromRank = c - '1';
+        else return INVALID_MOVE;
+    }
+    // Pawn captures always name the file they come from, pushes never leave it
+    if (pieceType == PieceType::Pawn) {
+        if (isCapture && fromFile == -1) return INVALID_MOVE;
+        if (!isCapture && fromFile == -1) fromFile = getFile(endSquare);
+    }
+
+    uint16_t match = INVALID_MOVE;
+    for (const uint16_t move : moves) {
+        const int from = getStart(move);
+        if (getEnd(move) != endSquare || getPromo(move) != promoType) continue;
+        if (pieceTypeOf(g.boards.pieceOn[from]) != pieceType) continue;
+        if (fromFile != -1 && getFile(from) != fromFile) continue;
+        if (fromRank != -1 && getRank(from) != fromRank) continue;
+        // Castling must be written as O-O, never as a king move
+        if (pieceType == PieceType::King && std::abs(endSquare - from) == 2) continue;
+
+        const bool capturesPiece = g.boards.pieceOn[endSquare] != NO_PIECE ||
+                                   (pieceType == PieceType::Pawn && endSquare == g.state.epSquare);
+        if (isCapture && !capturesPiece) continue;
+
+        // A second match means the input did not disambiguate enough
+        if (match != INVALID_MOVE) return INVALID_MOVE;
+        match = move;
+    }
+    return match;
+}
 
-    // Handle pawn promotion
-    char promoChar = '\0';
-    if (const size_t eqPos = input.find('='); eqPos != std::string::npos && eqPos + 1 < input.size()) {
-        promoChar = input[eqPos + 1];
-        input.erase(eqPos);  // Remove "=Q" from input so the rest parses cleanly
-    }
+// Writes a square such as "e4" to out and returns the position after it
+static char* writeSquare(char* out, const int square) {
+    *out++ = static_cast<char>('a' + getFile(square));
+    *out++ = static_cast<char>('1' + getRank(square));
+    return out;
+}
 
-    // Determine destination square (last two characters)
-    if (input.length() < 2) return INVALID_MOVE;
+// Whether the side to move checks the enemy king by playing move (which must be legal), without playing it.
+// Covers direct checks from the moved or promoted piece, the castling rook, and discovered checks,
+// including those opened by an en passant capture.
+bool givesCheck(const GameData& g, const uint16_t move) {
+    const BitBoards& b = g.boards;
+    const int us = colorOf(g.state.isWhiteTurn);
+    const int from = getStart(move);
+    const int to = getEnd(move);
+    const int kingSquare = lsb(b.of(us ^ 1, PieceType::King));
+    const PieceType moved = pieceTypeOf(b.pieceOn[from]);
+    const PieceType landed = getPromo(move) ? static_cast<PieceType>(getPromo(move)) : moved;
+
+    uint64_t occupied = (b.occupied() & ~mask(from)) | mask(to);
+    uint64_t diagonal = b.of(us, PieceType::Bishop) | b.of(us, PieceType::Queen);
+    uint64_t straight = b.of(us, PieceType::Rook) | b.of(us, PieceType::Queen);
+    diagonal &= ~mask(from);
+    straight &= ~mask(from);
+    if (landed == PieceType::Bishop || landed == PieceType::Queen) diagonal |= mask(to);
+    if (landed == PieceType::Rook || landed == PieceType::Queen) straight |= mask(to);
+
+    if (moved == PieceType::Pawn && to == g.state.epSquare) {
+        occupied &= ~mask(us == WHITE ? to - 8 : to + 8);
+    }
+    if (moved == PieceType::King && std::abs(to - from) == 2) {
+        const int rookFrom = to > from ? from + 3 : from - 4;
+        const int rookTo = (from + to) / 2;
+        occupied = (occupied & ~mask(rookFrom)) | mask(rookTo);
+        straight = (straight & ~mask(rookFrom)) | mask(rookTo);
+    }
+
+    // Pieces that do not slide can only give check directly
+    if (landed == PieceType::Pawn && (MoveTables::pawnAttacks[us][to] & mask(kingSquare))) return true;
+    if (landed == PieceType::Knight && (MoveTables::knightMoves[to] & mask(kingSquare))) return true;
+
+    // Sliders, moved or uncovered, against the occupancy after the move
+    return (MoveTables::getBishopAttacks(kingSquare, occupied) & diagonal) ||
+           (MoveTables::getRookAttacks(kingSquare, occupied) & straight);
+}
 
-    const std::string destStr = input.substr(input.size() - 2);
-    input.erase(input.size() - 2);
-    const int endSquare = coordsToNum(destStr);
-    if (endSquare == -1) return INVALID_MOVE;
+// Writes move (legal for the side to move) in SAN, e.g. "Nbd7", "exd8=Q+", "O-O#", using the least
+// disambiguation that identifies it. out must hold MAX_SAN_LENGTH chars; returns the length written.
+int moveToSAN(const GameData& g, const uint16_t move, char* out) {
+    char* const start = out;
+    const int from = getStart(move);
+    const int to = getEnd(move);
+    const PieceType pieceType = pieceTypeOf(g.boards.pieceOn[from]);
 
-    // Determine piece type (if not a pawn)
-    if (isupper(input[0]) && input[0] != 'O') {
-        pieceChar = input[0];
-        input = input.substr(1);
+    if (pieceType == PieceType::King && std::abs(to - from) == 2) {
+        const char* castle = to > from ? "O-O" : "O-O-O";
+        while (*castle) *out++ = *castle++;
     }
-
-    // Detect pawn promotion type
-    int promoType = 0;
-    switch (promoChar) {
-        case 'N': {
-            promoType = 1;
-            break;
-        }
-        case 'B': {
-            promoType = 2;
-            break;
-        }
-        case 'R': {
-            promoType = 3;
-            break;
+    else {
+        const bool isCapture = g.boards.pieceOn[to] != NO_PIECE ||
+                               (pieceType == PieceType::Pawn && to == g.state.epSquare);
+        if (pieceType == PieceType::Pawn) {
+            if (isCapture) *out++ = static_cast<char>('a' + getFile(from));
         }
-        case 'Q': {
-            promoType = 4;
-            break;
+        else {
+            *out++ = "PNBRQK"[static_cast<int>(pieceType)];
+
+            // Other pieces of the same type that can reach the same square
+            MoveList moves;
+            generateLegalMoves(g, moves);
+            bool ambiguous = false, sameFile = false, sameRank = false;
+            for (const uint16_t other : moves) {
+                const int otherFrom = getStart(other);
+                if (getEnd(other) != to || otherFrom == from || g.boards.pieceOn[otherFrom] != g.boards.pieceOn[from]) continue;
+                ambiguous = true;
+                sameFile |= getFile(otherFrom) == getFile(from);
+                sameRank |= getRank(otherFrom) == getRank(from);
+            }
+            if (ambiguous && (!sameFile || sameRank)) *out++ = static_cast<char>('a' + getFile(from));
+            if (ambiguous && sameFile) *out++ = static_cast<char>('1' + getRank(from));
         }
-        case '\0': {
-            break;
+        if (isCapture) *out++ = 'x';
+        out = writeSquare(out, to);
+        if (getPromo(move)) {
+            *out++ = '=';
+            *out++ = " NBRQ"[getPromo(move)];
         }
-        default: return INVALID_MOVE;
     }
 
-    // Only allow promotion by pawns on the last rank
-    if (promoType != 0) {
-        if (pieceChar != 'P') return INVALID_MOVE;
-        if (isWhiteTurn && getRank(endSquare) != 7) return INVALID_MOVE;
-        if (!isWhiteTurn && getRank(endSquare) != 0) return INVALID_MOVE;
-    }
-    // Make pawns on the last rank promote
-    else {
-        if (isWhiteTurn && getRank(endSquare) == 7) return INVALID_MOVE;
-        if (!isWhiteTurn && getRank(endSquare) == 0) return INVALID_MOVE;
-    }
-
-    // Disambiguation (e.g. Nbd2 or similar notation)
-    int disambigFile = -1;
-    int disambigRank = -1;
-    if (!input.empty()) {
-        if (input[0] >= 'a' && input[0] <= 'h') disambigFile = input[0] - 'a';
-        else if (input[0] >= '1' && input[0] <= '8') disambigRank = input[0] - '1';
-        if (input.size() > 1) {
-             if (input[1] >= '1' && input[1] <= '8') disambigRank = input[1] - '1';
-        }
+    if (givesCheck(g, move)) {
+        // Only a check can be mate, so the reply generation is limited to checking moves
+        GameData after = g;
+        makeMove(after, move, g.state.isWhiteTurn);
+        MoveList replies;
+        generateLegalMoves(after, replies);
+        *out++ = replies.count ? '+' : '#';
     }
+    *out = '\0';
+    return static_cast<int>(out - start);
+}
 
-    // Identify candidate pieces of that type
-    uint64_t* pieceBB = nullptr;
-    switch (pieceChar) {
-        case 'N': pieceBB = isWhiteTurn ? &game.boards.wKnights : &game.boards.bKnights; break;
-        case 'B': pieceBB = isWhiteTurn ? &game.boards.wBishops : &game.boards.bBishops; break;
-        case 'R': pieceBB = isWhiteTurn ? &game.boards.wRooks   : &game.boards.bRooks;   break;
-        case 'Q': pieceBB = isWhiteTurn ? &game.boards.wQueens  : &game.boards.bQueens;  break;
-        case 'K': pieceBB = isWhiteTurn ? &game.boards.wKing    : &game.boards.bKing;    break;
-        case 'P': pieceBB = isWhiteTurn ? &game.boards.wPawns   : &game.boards.bPawns;   break;
-        default: return INVALID_MOVE; // Unknown piece
-    }
-
-    // Try all pieces of that type and return the one that can legally move to endSquare
-    // Fails if the move is ambiguous
-    bool uniqueMatchFound = false;
-    uint16_t possibleMove = INVALID_MOVE;
-    for (int sq = 0; sq < 64; sq++) {
-        if ((*pieceBB) & mask(sq)) {
-            // Check disambiguation info
-            if (disambigFile != -1 && getFile(sq) != disambigFile) continue;
-            if (disambigRank != -1 && getRank(sq) != disambigRank) continue;
-            // Check if piece movement works
-            if (const uint16_t candidateMove = encodeMove(sq, endSquare, promoType); isValidMove(candidateMove, isWhiteTurn)) {
-                if (uniqueMatchFound) return INVALID_MOVE;
-                uniqueMatchFound = true;
-                possibleMove = candidateMove;
-            }
-        }
-    }
-    return possibleMove;
+// Writes move in long algebraic (UCI) form, e.g. "e2e4" or "e7e8q". out must hold MAX_SAN_LENGTH chars.
+int moveToLAN(const uint16_t move, char* out) {
+    char* const start = out;
+    out = writeSquare(out, getStart(move));
+    out = writeSquare(out, getEnd(move));
+    if (getPromo(move)) *out++ = " nbrq"[getPromo(move)];
+    *out = '\0';
+    return static_cast<int>(out - start);
 }
 
-bool isSquareAttacked(GameData game, uint64_t targetMask, bool byWhite) {
-    int square = __builtin_ctzll(targetMask);  // GCC/Clang: gets index of least significant bit
-    BitBoards& b = game.boards;
+bool isSquareAttacked(const int square, const bool byWhite, const BitBoards& b) {
+    const uint64_t* them = b.pieces[colorOf(byWhite)];
 
-    // Pawns
-    if (byWhite) {
-        if (((targetMask & ~files.A_FILE) >> 7) & b.wPawns) return true;  // left capture
-        if (((targetMask & ~files.H_FILE) >> 9) & b.wPawns) return true;  // right capture
-    }
-    else {
-        if (((targetMask & ~files.H_FILE) << 7) & b.bPawns) return true;
-        if (((targetMask & ~files.A_FILE) << 9) & b.bPawns) return true;
-    }
+    // Pawns: a white pawn attacks square from where a black pawn on square would attack, and vice versa
+    if (MoveTables::pawnAttacks[byWhite ? 1 : 0][square] & them[static_cast<int>(PieceType::Pawn)]) return true;
 
     // Knights
-    if (MoveTables::knightMoves[square] & (byWhite ? b.wKnights : b.bKnights)) return true;
+    if (MoveTables::knightMoves[square] & them[static_cast<int>(PieceType::Knight)]) return true;
 
     // Kings
-    if (MoveTables::kingMoves[square] & (byWhite ? b.wKing : b.bKing)) return true;
+    if (MoveTables::kingMoves[square] & them[static_cast<int>(PieceType::King)]) return true;
 
     // Bishop/Queen attacks
-    uint64_t blockers = b.wPieces | b.bPieces;
-    uint64_t bishopMask = MoveTables::generateBishopBlockerMask(square);
-    int index = MoveTables::getBlockerIndex(bishopMask, blockers);
-    if (MoveTables::bishopMoves[square][index] & (byWhite ? b.wBishops | b.wQueens : b.bBishops | b.bQueens)) return true;
+    const uint64_t blockers = b.occupied();
+    const uint64_t queens = them[static_cast<int>(PieceType::Queen)];
+    if (MoveTables::getBishopAttacks(square, blockers) & (them[static_cast<int>(PieceType::Bishop)] | queens)) return true;
 
     // Rook/Queens
-    uint64_t rookMask = MoveTables::generateRookBlockerMask(square);
-    index = MoveTables::getBlockerIndex(rookMask, blockers);
-    if (MoveTables::rookMoves[square][index] & (byWhite ? b.wRooks | b.wQueens : b.bRooks | b.bQueens)) return true;
+    if (MoveTables::getRookAttacks(square, blockers) & (them[static_cast<int>(PieceType::Rook)] | queens)) return true;
 
     return false;
 }
 
-bool isMoveLegal(uint16_t move, bool isWhiteTurn) {
-    GameData tempGame = game;
-    makeMove(tempGame, move, isWhiteTurn);
-    uint64_t kingMask = isWhiteTurn ? tempGame.boards.wKing : tempGame.boards.bKing;
-    return !isSquareAttacked(tempGame, kingMask, !isWhiteTurn);
+bool isSquareAttacked(const GameData& g, uint64_t targetMask, bool byWhite) {
+    return isSquareAttacked(lsb(targetMask), byWhite, g.boards);
 }
 
-void makeMove(GameData& g, uint16_t move, bool isWhiteTurn) {
-    int from = getStart(move);
-    int to   = getEnd(move);
-
-    uint64_t fromMask = mask(from);
-    uint64_t toMask   = mask(to);
-    BitBoards& b = g.boards;
+// Plays the move on g and takes it back, checking that the mover's king is not left attacked
+bool isMoveLegal(GameData& g, uint16_t move, bool isWhiteTurn) {
+    const int from = getStart(move);
+    const int to = getEnd(move);
 
-    // Identify Piece Type
-    uint64_t* myBitboards[6] = {
-        isWhiteTurn ? &b.wPawns   : &b.bPawns,
-        isWhiteTurn ? &b.wKnights : &b.bKnights,
-        isWhiteTurn ? &b.wBishops : &b.bBishops,
-        isWhiteTurn ? &b.wRooks   : &b.bRooks,
-        isWhiteTurn ? &b.wQueens  : &b.bQueens,
-        isWhiteTurn ? &b.wKing    : &b.bKing
-    };
-    PieceType pieceType = PieceType::None;
-    for (int i = 0; i < 6; ++i) {
-        if (*myBitboards[i] & fromMask) {
-            pieceType = static_cast<PieceType>(i);
-            break;
-        }
+    // Castling may not start in check or pass through an attacked square
+    if ((mask(from) & g.boards.of(colorOf(isWhiteTurn), PieceType::King)) && std::abs(to - from) == 2) {
+        if (isSquareAttacked(from, !isWhiteTurn, g.boards)) return false;
+        if (isSquareAttacked((from + to) / 2, !isWhiteTurn, g.boards)) return false;
     }
 
-    // Move rook for castling
-    if (pieceType == PieceType::King && std::abs(to - from) == 2) {
-        // Determine rook source/destination
-        if (isWhiteTurn) {
-            if (to == 6) { // White king-side
-                b.wRooks &= ~mask(7);   // Remove h1 rook
-                b.wPieces &= ~mask(7);
-                b.wRooks |= mask(5);    // Move to f1
-                b.wPieces |= mask(5);
-            } else if (to == 2) { // White queen-side
-                b.wRooks &= ~mask(0);   // Remove a1 rook
-                b.wPieces &= ~mask(0);
-                b.wRooks |= mask(3);    // Move to d1
-                b.wPieces |= mask(3);
-            }
-        } else {
-            if (to == 62) { // Black king-side
-                b.bRooks &= ~mask(63);  // Remove h8 rook
-                b.bPieces &= ~mask(63);
-                b.bRooks |= mask(61);   // Move to f8
-                b.bPieces |= mask(61);
-            } else if (to == 58) { // Black queen-side
-                b.bRooks &= ~mask(56);  // Remove a8 rook
-                b.bPieces &= ~mask(56);
-                b.bRooks |= mask(59);   // Move to d8
-                b.bPieces |= mask(59);
-            }
-        }
-    }
+    const UndoInfo undo = makeMove(g, move, isWhiteTurn);
+    uint64_t kingMask = g.boards.of(colorOf(isWhiteTurn), PieceType::King);
+    const bool legal = !isSquareAttacked(lsb(kingMask), !isWhiteTurn, g.boards);
+    unmakeMove(g, move, undo);
+    return legal;
+}
+
+// Finds the rook's start and end squares if the king move from -> to is castling
+static bool castlingRookSquares(const int from, const int to, int& rookFrom, int& rookTo) {
+    if (std::abs(to - from) != 2) return false;
+    rookFrom = to > from ? from + 3 : from - 4;
+    rookTo = (from + to) / 2;
+    return true;
+}
+
+// Board edits for makeMove() that keep the incremental Zobrist key in step; square must hold a piece
+static void hashedRemove(GameData& g, const int square) {
+    g.state.hash ^= Zobrist::pieceKeys[g.boards.pieceOn[square]][square];
+    g.boards.removePieceAtSquare(square);
+}
+static void hashedAdd(GameData& g, const int square, const uint8_t piece) {
+    g.state.hash ^= Zobrist::pieceKeys[piece][square];
+    g.boards.addPiece(square, piece);
+}
+
+// Plays move for isWhiteTurn and passes the turn to the other side. The returned UndoInfo lets
+// unmakeMove() restore the position exactly.
+UndoInfo makeMove(GameData& g, uint16_t move, bool isWhiteTurn) {
+    const int from = getStart(move);
+    const int to   = getEnd(move);
+    const BitBoards& b = g.boards;
+
+    UndoInfo undo;
+    undo.castling = g.state.castling;
+    undo.epSquare = g.state.epSquare;
+    undo.moveCounter = g.state.moveCounter;
+    undo.hash = g.state.hash;
+
+    const uint8_t piece = b.pieceOn[from];
+    const PieceType pieceType = pieceTypeOf(piece);
+    // Read before the board changes: whether the current key includes the ep file
+    const bool epWasHashed = epInHash(b, g.state.epSquare, isWhiteTurn);
 
     // Clear captured piece
-    b.removePieceAtSquare(to);
+    undo.captured = pieceTypeOf(b.pieceOn[to]);
+    if (undo.captured != PieceType::None) {
+        hashedRemove(g, to);
+    }
 
     // Handle en passant capture
     if (pieceType == PieceType::Pawn && to == g.state.epSquare) {
-        int capturedPawnSquare = isWhiteTurn ? to - 8 : to + 8;
-        uint64_t capturedMask = mask(capturedPawnSquare);
-
-        // Remove captured pawn from bitboards
-        (isWhiteTurn ? b.bPawns : b.wPawns) &= ~capturedMask;
-        (isWhiteTurn ? b.bPieces : b.wPieces) &= ~capturedMask;
+        hashedRemove(g, isWhiteTurn ? to - 8 : to + 8);
+        undo.captured = PieceType::Pawn;
     }
 
-
-    int promoType = getPromo(move);
+    // Move the piece; a promoting pawn is replaced by the promoted piece (promo codes match PieceType)
+    const int promoType = getPromo(move);
+    hashedRemove(g, from);
     if (pieceType == PieceType::Pawn && promoType != 0) {
-        // Remove Pawn
-        (isWhiteTurn ? b.wPawns : b.bPawns) &= ~fromMask;
-
-        // Add the promoted piece
-        switch (promoType) {
-            case 1: (isWhiteTurn ? b.wKnights : b.bKnights) |= toMask; break;
-            case 2: (isWhiteTurn ? b.wBishops : b.bBishops) |= toMask; break;
-            case 3: (isWhiteTurn ? b.wRooks   : b.bRooks)   |= toMask; break;
-            case 4: (isWhiteTurn ? b.wQueens  : b.bQueens)  |= toMask; break;
-            default: break;
-        }
+        hashedAdd(g, to, makePiece(isWhiteTurn, static_cast<PieceType>(promoType)));
     } else {
-        int pieceIdx = static_cast<int>(pieceType);
-        *myBitboards[pieceIdx] &= ~fromMask;
-        *myBitboards[pieceIdx] |=  toMask;
+        hashedAdd(g, to, piece);
     }
 
-    if (isWhiteTurn) {
-        b.wPieces &= ~fromMask;
-        b.wPieces |= toMask;
-        b.bPieces &= ~toMask;
-    } else {
-        b.bPieces &= ~fromMask;
-        b.bPieces |= toMask;
-        b.wPieces &= ~toMask;
+    // Move rook for castling
+    int rookFrom, rookTo;
+    if (pieceType == PieceType::King && castlingRookSquares(from, to, rookFrom, rookTo)) {
+        hashedRemove(g, rookFrom);
+        hashedAdd(g, rookTo, makePiece(isWhiteTurn, PieceType::Rook));
     }
+
     // Update castling and en passant square
     updateCastlingRights(g, move);
+    g.state.hash ^= Zobrist::castlingKeys[undo.castling] ^ Zobrist::castlingKeys[g.state.castling];
+    if (epWasHashed) {
+        g.state.hash ^= Zobrist::epFileKeys[getFile(g.state.epSquare)];
+    }
     g.state.epSquare = -1;
     if (pieceType == PieceType::Pawn && std::abs(to - from) == 16) {
         g.state.epSquare = isWhiteTurn ? from + 8 : from - 8;
+        if (epInHash(b, g.state.epSquare, !isWhiteTurn)) {
+            g.state.hash ^= Zobrist::epFileKeys[getFile(g.state.epSquare)];
+        }
     }
 
+    // Pawn moves and captures reset the fifty-move counter
+    g.state.moveCounter = (pieceType == PieceType::Pawn || undo.captured != PieceType::None) ? 0 : g.state.moveCounter + 1;
+    if (!isWhiteTurn) g.state.fullmoveNumber++;
+    g.state.isWhiteTurn = !isWhiteTurn;
+    g.state.hash ^= Zobrist::sideKey;
+
+#ifdef CHESS_DEBUG_HASH
+    if (g.state.hash != computeHash(g)) {
+        std::cerr << "Zobrist key mismatch after " << squareName(from) << squareName(to) << "\n";
+        std::abort();
+    }
+#endif
+    return undo;
+}
+
+// Takes back move, which must be the last move played on g by makeMove()
+void unmakeMove(GameData& g, uint16_t move, const UndoInfo& undo) {
+    const bool isWhiteTurn = !g.state.isWhiteTurn;  // the side that played move
+    const int from = getStart(move);
+    const int to   = getEnd(move);
+    BitBoards& b = g.boards;
+
+    // Move the piece back; a promoted piece turns back into the pawn
+    uint8_t piece = b.pieceOn[to];
+    b.removePieceAtSquare(to);
+    if (getPromo(move) != 0) {
+        piece = makePiece(isWhiteTurn, PieceType::Pawn);
+    }
+    b.addPiece(from, piece);
+    const PieceType pieceType = pieceTypeOf(piece);
+
+    // Move the rook back if castling
+    int rookFrom, rookTo;
+    if (pieceType == PieceType::King && castlingRookSquares(from, to, rookFrom, rookTo)) {
+        b.removePieceAtSquare(rookTo);
+        b.addPiece(rookFrom, makePiece(isWhiteTurn, PieceType::Rook));
+    }
+
+    // Restore the captured piece; an en passant victim sat behind the target square
+    if (undo.captured != PieceType::None) {
+        int capturedSquare = to;
+        if (pieceType == PieceType::Pawn && to == undo.epSquare) {
+            capturedSquare = isWhiteTurn ? to - 8 : to + 8;
+        }
+        b.addPiece(capturedSquare, makePiece(!isWhiteTurn, undo.captured));
+    }
+
+    if (!isWhiteTurn) g.state.fullmoveNumber--;
+    g.state.isWhiteTurn = isWhiteTurn;
+    g.state.castling = undo.castling;
+    g.state.epSquare = undo.epSquare;
+    g.state.moveCounter = undo.moveCounter;
+    g.state.hash = undo.hash;
+}
+
+// Puts piece on an empty square
+void BitBoards::addPiece(const int square, const uint8_t piece) {
+    const uint64_t sqMask = mask(square);
+    pieceBoard(piece) |= sqMask;
+    occupancy[piece / NUM_PIECE_TYPES] |= sqMask;
+    pieceOn[square] = piece;
 }
 
 void BitBoards::removePieceAtSquare(int square) {
-    uint64_t notMask = ~mask(square);
-
-    wPawns   &= notMask;
-    bPawns   &= notMask;
-    wKnights &= notMask;
-    bKnights &= notMask;
-    wBishops &= notMask;
-    bBishops &= notMask;
-    wRooks   &= notMask;
-    bRooks   &= notMask;
-    wQueens  &= notMask;
-    bQueens  &= notMask;
-    wKing    &= notMask;
-    bKing    &= notMask;
-    wPieces  &= notMask;
-    bPieces  &= notMask;
-}
-
-bool hasLegalMoves(bool isWhiteTurn) {
-    // Try every square
-    for (int from = 0; from < 64; ++from) {
-        if (isWhiteTurn && !(mask(from) & game.boards.wPieces)) continue;
-        if (!isWhiteTurn && !(mask(from) & game.boards.bPieces)) continue;
-
-        // Try every destination
-        for (int to = 0; to < 64; ++to) {
-            if (from == to) continue;
-
-            uint16_t move = encodeMove(from, to, 0);  // promotion = 0 (can skip for now)
-
-            if (isValidMove(move, isWhiteTurn) && isMoveLegal(move, isWhiteTurn)) {
-                return true;
+    const uint8_t piece = pieceOn[square];
+    if (piece == NO_PIECE) return;
+
+    const uint64_t notMask = ~mask(square);
+    pieceBoard(piece) &= notMask;
+    occupancy[piece / NUM_PIECE_TYPES] &= notMask;
+    pieceOn[square] = NO_PIECE;
+}
+
+// Fills pieceOn from the bitboards, for code that sets the bitboards directly
+void BitBoards::rebuildMailbox() {
+    for (int square = 0; square < 64; square++) {
+        pieceOn[square] = NO_PIECE;
+        for (uint8_t piece = 0; piece < NO_PIECE; piece++) {
+            if (pieceBoard(piece) & mask(square)) {
+                pieceOn[square] = piece;
+                break;
             }
         }
     }
-    return false;
 }
 
-bool isCheckmate(bool isWhiteTurn) {
-    uint64_t kingMask = isWhiteTurn ? game.boards.wKing : game.boards.bKing;
-    bool inCheck = isSquareAttacked(game, kingMask, !isWhiteTurn);
-    return inCheck && !hasLegalMoves(isWhiteTurn);
+bool hasLegalMoves(const GameData& g, bool isWhiteTurn) {
+    GameData position = g;
+    position.state.isWhiteTurn = isWhiteTurn;
+
+    MoveList moves;
+    generateLegalMoves(position, moves);
+    return moves.count > 0;
+}
+
+bool isCheckmate(const GameData& g, bool isWhiteTurn) {
+    uint64_t kingMask = g.boards.of(colorOf(isWhiteTurn), PieceType::King);
+    bool inCheck = isSquareAttacked(g, kingMask, !isWhiteTurn);
+    return inCheck && !hasLegalMoves(g, isWhiteTurn);
+}
+
+bool isStalemate(const GameData& g, bool isWhiteTurn) {
+    uint64_t kingMask = g.boards.of(colorOf(isWhiteTurn), PieceType::King);
+    bool inCheck = isSquareAttacked(g, kingMask, !isWhiteTurn);
+    return !inCheck && !hasLegalMoves(g, isWhiteTurn);
+}
+
+// Counts earlier occurrences of the current position. A pawn move or capture can never be undone, so
+// only the last halfmoveClock plies can repeat it, and of those only every second one has the same
+// side to move.
+int GameHistory::repetitions(const int halfmoveClock) const {
+    const int current = static_cast<int>(keys.size()) - 1;
+    const int oldest = std::max(0, current - halfmoveClock);
+    int count = 0;
+    for (int i = current - 2; i >= oldest; i -= 2) {
+        if (keys[i] == keys[current]) count++;
+    }
+    return count;
 }
 
-bool isStalemate(bool isWhiteTurn) {
-    uint64_t kingMask = isWhiteTurn ? game.boards.wKing : game.boards.bKing;
-    bool inCheck = isSquareAttacked(game, kingMask, !isWhiteTurn);
-    return !inCheck && !hasLegalMoves(isWhiteTurn);
-}
\ No newline at end of file
+bool isThreefoldRepetition(const GameHistory& history, const GameData& g) {
+    return history.repetitions(g.state.moveCounter) >= 2;
+}
+
+// Fifty moves by each side without a pawn move or capture
+bool isFiftyMoveDraw(const GameData& g) {
+    return g.state.moveCounter >= 100;
+}
@@ -1,7 +1,15 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(_M_X64))
+#include <immintrin.h>
+#define CHESS_HAS_PEXT 1
+#endif
 
 enum class PieceType {
     Pawn = 0,
@@ -12,6 +20,15 @@ enum class PieceType {
     King,
     None = -1
 };
+// Piece codes used by the mailbox, in Zobrist piece order: white pawn..king 0-5, black pawn..king 6-11
+constexpr uint8_t NO_PIECE = 12;
+constexpr uint8_t makePiece(const bool isWhite, const PieceType type) {
+    return static_cast<uint8_t>((isWhite ? 0 : 6) + static_cast<int>(type));
+}
+constexpr PieceType pieceTypeOf(const uint8_t piece) {
+    return piece == NO_PIECE ? PieceType::None : static_cast<PieceType>(piece % 6);
+}
+
 constexpr uint16_t INVALID_MOVE = 0b1000000000000000;
 constexpr int NUM_PIECE_TYPES = 6;
 constexpr int CASTLE_WK = 1 << 0;
@@ -22,30 +39,72 @@ constexpr int CASTLE_BQ = 1 << 3;
 struct boardState {
     // true if white's turn, false if black's turn
     bool isWhiteTurn = false;
-    // moveCounter = moves since lsat 50-move-rule reset
+    // moveCounter = half-moves since the last pawn move or capture (the fifty-move rule clock)
     int moveCounter = 0;
+    // Starts at 1 and goes up after each black move
+    int fullmoveNumber = 1;
     // castling represents whether castling would be legal for each side (changes when kings/rooks are moved)
     int castling = 0;
     // The square that en passant is available on (-1 if not available, 0-63 if available)
     int epSquare = 0;
+    // Zobrist key of the position, kept up to date by makeMove/unmakeMove
+    uint64_t hash = 0;
 };
-struct BitBoards {
-    uint64_t wPawns;
-    uint64_t bPawns;
-    uint64_t wKnights;
-    uint64_t bKnights;
-    uint64_t wRooks;
-    uint64_t bRooks;
-    uint64_t wBishops;
-    uint64_t bBishops;
-    uint64_t wQueens;
-    uint64_t bQueens;
-    uint64_t wKing;
-    uint64_t bKing;
-    uint64_t wPieces;
-    uint64_t bPieces;
+enum Color {
+    WHITE = 0,
+    BLACK = 1
+};
+constexpr int colorOf(const bool isWhite) {
+    return isWhite ? WHITE : BLACK;
+}
+
+// Cache-line aligned: the 14 bitboards take the first 112 bytes and the mailbox follows them
+struct alignas(64) BitBoards {
+    // pieces[color][PieceType]
+    uint64_t pieces[2][NUM_PIECE_TYPES];
+    // occupancy[color]: all pieces of that color
+    uint64_t occupancy[2];
+    // Piece code on each square (NO_PIECE if empty), kept in sync by addPiece/removePieceAtSquare
+    uint8_t pieceOn[64];
 
+    uint64_t& of(const int color, const PieceType type) { return pieces[color][static_cast<int>(type)]; }
+    uint64_t of(const int color, const PieceType type) const { return pieces[color][static_cast<int>(type)]; }
+    uint64_t occupied() const { return occupancy[WHITE] | occupancy[BLACK]; }
+
+    // Named accessors for code that deals with one fixed color
+    uint64_t& wPawns()   { return pieces[WHITE][0]; }
+    uint64_t& wKnights() { return pieces[WHITE][1]; }
+    uint64_t& wBishops() { return pieces[WHITE][2]; }
+    uint64_t& wRooks()   { return pieces[WHITE][3]; }
+    uint64_t& wQueens()  { return pieces[WHITE][4]; }
+    uint64_t& wKing()    { return pieces[WHITE][5]; }
+    uint64_t& bPawns()   { return pieces[BLACK][0]; }
+    uint64_t& bKnights() { return pieces[BLACK][1]; }
+    uint64_t& bBishops() { return pieces[BLACK][2]; }
+    uint64_t& bRooks()   { return pieces[BLACK][3]; }
+    uint64_t& bQueens()  { return pieces[BLACK][4]; }
+    uint64_t& bKing()    { return pieces[BLACK][5]; }
+    uint64_t& wPieces()  { return occupancy[WHITE]; }
+    uint64_t& bPieces()  { return occupancy[BLACK]; }
+    uint64_t wPawns()   const { return pieces[WHITE][0]; }
+    uint64_t wKnights() const { return pieces[WHITE][1]; }
+    uint64_t wBishops() const { return pieces[WHITE][2]; }
+    uint64_t wRooks()   const { return pieces[WHITE][3]; }
+    uint64_t wQueens()  const { return pieces[WHITE][4]; }
+    uint64_t wKing()    const { return pieces[WHITE][5]; }
+    uint64_t bPawns()   const { return pieces[BLACK][0]; }
+    uint64_t bKnights() const { return pieces[BLACK][1]; }
+    uint64_t bBishops() const { return pieces[BLACK][2]; }
+    uint64_t bRooks()   const { return pieces[BLACK][3]; }
+    uint64_t bQueens()  const { return pieces[BLACK][4]; }
+    uint64_t bKing()    const { return pieces[BLACK][5]; }
+    uint64_t wPieces()  const { return occupancy[WHITE]; }
+    uint64_t bPieces()  const { return occupancy[BLACK]; }
+
+    uint64_t& pieceBoard(uint8_t piece) { return pieces[piece / NUM_PIECE_TYPES][piece % NUM_PIECE_TYPES]; }
+    void addPiece(int square, uint8_t piece);
     void removePieceAtSquare(int square);
+    void rebuildMailbox();
 };
 
 struct FileMasks {
@@ -58,7 +117,10 @@ struct FileMasks {
     uint64_t G_FILE;
     uint64_t H_FILE;
 };
-extern FileMasks files;
+inline constexpr FileMasks files = {
+    0x0101010101010101ULL, 0x0202020202020202ULL, 0x0404040404040404ULL, 0x0808080808080808ULL,
+    0x1010101010101010ULL, 0x2020202020202020ULL, 0x4040404040404040ULL, 0x8080808080808080ULL
+};
 
 struct RankMasks {
     uint64_t FIRST_RANK;
@@ -70,73 +132,212 @@ struct RankMasks {
     uint64_t SEVENTH_RANK;
     uint64_t EIGHTH_RANK;
 };
-extern RankMasks ranks;
+inline constexpr RankMasks ranks = {
+    0x00000000000000FFULL, 0x000000000000FF00ULL, 0x0000000000FF0000ULL, 0x00000000FF000000ULL,
+    0x000000FF00000000ULL, 0x0000FF0000000000ULL, 0x00FF000000000000ULL, 0xFF00000000000000ULL
+};
 
 struct GameData{
     boardState state;
     BitBoards boards;
 };
-extern GameData game;
+
+// What makeMove() overwrites and unmakeMove() needs back
+struct UndoInfo {
+    PieceType captured = PieceType::None;
+    int castling = 0;
+    int epSquare = -1;
+    int moveCounter = 0;
+    uint64_t hash = 0;
+};
+
+// Zobrist keys of every position reached in a game, oldest first; keys.back() is the current position
+struct GameHistory {
+    std::vector<uint64_t> keys;
+
+    void reset(const GameData& g) { keys.assign(1, g.state.hash); }
+    void push(const uint64_t key) { keys.push_back(key); }
+    void pop() { keys.pop_back(); }
+    int repetitions(int halfmoveClock) const;
+};
+
+// Buffer size for moveToSAN()/moveToLAN(), including the terminating null
+constexpr int MAX_SAN_LENGTH = 16;
+
+// Longest FEN toFEN() can write, including the terminating null
+constexpr int MAX_FEN_LENGTH = 128;
+
+// One EPD operation, e.g. opcode "bm" with operands "Nf3 Qd2". Both point into the parsed record.
+struct EpdOperation {
+    std::string_view opcode;
+    std::string_view operands;
+};
+constexpr int MAX_EPD_OPERATIONS = 32;
+struct EpdOperations {
+    EpdOperation ops[MAX_EPD_OPERATIONS];
+    int count = 0;
+
+    const EpdOperation* find(std::string_view opcode) const;
+    const EpdOperation* begin() const { return ops; }
+    const EpdOperation* end() const { return ops + count; }
+};
+
+// Fixed-capacity move buffer meant to live on the stack; no position has more than 218 legal moves
+constexpr int MAX_MOVES = 256;
+struct MoveList {
+    uint16_t moves[MAX_MOVES];
+    int count = 0;
+
+    void add(const uint16_t move) { moves[count++] = move; }
+    const uint16_t* begin() const { return moves; }
+    const uint16_t* end() const { return moves + count; }
+};
 
 // ~~~~~~~~~~~~~~~~ Board Setup and Game Cycle Section ~~~~~~~~~~~~~~~~
 
 namespace MoveTables {
-    extern uint64_t knightMoves[64];
-    extern uint64_t kingMoves[64];
-    extern uint64_t rookMoves[64][4096];
-    extern uint64_t bishopMoves[64][512];
+    // Sum of 1 << popcount(blocker mask) over all squares
+    constexpr int ROOK_TABLE_SIZE = 102400;
+    constexpr int BISHOP_TABLE_SIZE = 5248;
 
-    void initKnightMoves();
-    void initKingMoves();
+    // All tables are generated at compile time in movetables.cpp
+    extern const std::array<uint64_t, 64> knightMoves;
+    extern const std::array<uint64_t, 64> kingMoves;
+    // pawnAttacks[0][sq]: squares a white pawn on sq attacks, pawnAttacks[1][sq]: same for black
+    extern const std::array<std::array<uint64_t, 64>, 2> pawnAttacks;
 
-    int getBlockerIndex(uint64_t mask, uint64_t blockers);
-    uint64_t setBlockersFromIndex(uint64_t mask, int index);
+    // betweenMasks[a][b]: squares strictly between two aligned squares; lineMasks[a][b]: the full line through them
+    extern const std::array<std::array<uint64_t, 64>, 64> betweenMasks;
+    extern const std::array<std::array<uint64_t, 64>, 64> lineMasks;
 
-    // ~~~~~~~~~~~~~~~~ Rook move generation section ~~~~~~~~~~~~~~~~
+    // Packed slider tables: square sq owns the 1 << popcount(mask) entries starting at its offset.
+    // rookMoves/bishopMoves are laid out by magic index, the Pext tables by _pext_u64 index.
+    extern const std::array<uint64_t, ROOK_TABLE_SIZE> rookMoves;
+    extern const std::array<uint64_t, BISHOP_TABLE_SIZE> bishopMoves;
+    extern const std::array<uint64_t, ROOK_TABLE_SIZE> rookPextMoves;
+    extern const std::array<uint64_t, BISHOP_TABLE_SIZE> bishopPextMoves;
+    extern const std::array<int, 64> rookOffsets;
+    extern const std::array<int, 64> bishopOffsets;
 
-    uint64_t generateRookBlockerMask(int square);
-    uint64_t computeRookAttacks(int square, uint64_t blockers);
-    void initRookMoves();
+    // Magic bitboard data: premasked relevant blockers, magic multipliers and index shifts
+    extern const std::array<uint64_t, 64> rookMasks;
+    extern const std::array<uint64_t, 64> bishopMasks;
+    extern const uint64_t rookMagics[64];
+    extern const uint64_t bishopMagics[64];
+    extern const std::array<int, 64> rookShifts;
+    extern const std::array<int, 64> bishopShifts;
 
-    // ~~~~~~~~~~~~~~~~ Bishop move generation section ~~~~~~~~~~~~~~~~
+    // Slider index backend, chosen once in init(): BMI2 PEXT when the CPU supports it, magics otherwise
+    extern bool usePext;
 
-    uint64_t generateBishopBlockerMask(int square);
-    uint64_t computeBishopAttacks(int square, uint64_t blockers);
-    void initBishopMoves();
+#ifdef CHESS_HAS_PEXT
+#ifdef __BMI2__
+    inline uint64_t pext(const uint64_t source, const uint64_t selector) {
+        return _pext_u64(source, selector);
+    }
+#else
+    // Only reached when usePext is set, so the BMI2 instruction never runs on older CPUs
+    __attribute__((target("bmi2"))) inline uint64_t pext(const uint64_t source, const uint64_t selector) {
+        return _pext_u64(source, selector);
+    }
+#endif
+#endif
+
+    bool cpuSupportsPext();
+
+    inline int getRookMagicIndex(const int square, const uint64_t occupied) {
+        return static_cast<int>(((occupied & rookMasks[square]) * rookMagics[square]) >> rookShifts[square]);
+    }
+    inline int getBishopMagicIndex(const int square, const uint64_t occupied) {
+        return static_cast<int>(((occupied & bishopMasks[square]) * bishopMagics[square]) >> bishopShifts[square]);
+    }
+
+    inline uint64_t getRookAttacks(const int square, const uint64_t occupied) {
+#ifdef CHESS_HAS_PEXT
+        if (usePext) return rookPextMoves[rookOffsets[square] + pext(occupied, rookMasks[square])];
+#endif
+        return rookMoves[rookOffsets[square] + getRookMagicIndex(square, occupied)];
+    }
+    inline uint64_t getBishopAttacks(const int square, const uint64_t occupied) {
+#ifdef CHESS_HAS_PEXT
+        if (usePext) return bishopPextMoves[bishopOffsets[square] + pext(occupied, bishopMasks[square])];
+#endif
+        return bishopMoves[bishopOffsets[square] + getBishopMagicIndex(square, occupied)];
+    }
+    inline uint64_t getQueenAttacks(const int square, const uint64_t occupied) {
+        return getRookAttacks(square, occupied) | getBishopAttacks(square, occupied);
+    }
 
     void init();
+    size_t memoryFootprint();
+    // To stderr, so it stays out of the machine-readable output of perft and chesstool
+    void printDiagnostics();
 
 }
 
-void setupFiles();
-void setupRanks();
-void setupStartingPosition();
-void setupState();
+void setupStartingPosition(GameData& g);
+void setupState(GameData& g);
+void setupNewGame(GameData& g, GameHistory& history);
 void setup();
-void printBoard();
+bool loadFEN(std::string_view fen, GameData& g);
+bool loadEPD(std::string_view epd, GameData& g, EpdOperations& ops);
+int toFEN(const GameData& g, char* buf);
+void printBoard(const GameData& g);
 [[noreturn]] void runInConsole();
 
 // ~~~~~~~~~~~~~~~~ Move Calculating/Parsing section ~~~~~~~~~~~~~~~~
 
-bool isValidMove(uint16_t nextMove, bool isWhiteTurn);
-bool followsPieceMovementRules(PieceType pieceType, uint16_t nextMove, bool isWhiteTurn);
-bool move(uint16_t nextMove, bool isWhiteTurn);
+bool isValidMove(const GameData& g, uint16_t nextMove, bool isWhiteTurn);
+bool followsPieceMovementRules(const GameData& g, PieceType pieceType, uint16_t nextMove, bool isWhiteTurn);
+bool move(GameData& g, GameHistory& history, uint16_t nextMove, bool isWhiteTurn);
 void updateCastlingRights(GameData& g, uint64_t nextMove);
-char getPieceAt(int square);
-int coordsToNum(const std::string& input);
+char getPieceAt(const GameData& g, int square);
+int coordsToNum(std::string_view input);
 std::string squareName(int square);
-uint16_t parseAlgebraicMove(std::string input, bool isWhiteTurn);
+uint16_t parseSAN(const GameData& g, std::string_view san);
+bool givesCheck(const GameData& g, uint16_t move);
+int moveToSAN(const GameData& g, uint16_t move, char* out);
+int moveToLAN(uint16_t move, char* out);
 bool isSquareAttacked(int square, bool byWhite, const BitBoards& b);
-bool isMoveLegal(uint16_t move, bool isWhiteTurn);
-void makeMove(GameData& g, uint16_t move, bool isWhiteTurn);
-bool hasLegalMoves(bool isWhiteTurn);
-bool isCheckmate(bool isWhiteTurn);
-bool isStalemate(bool isWhiteTurn);
+bool isMoveLegal(GameData& g, uint16_t move, bool isWhiteTurn);
+UndoInfo makeMove(GameData& g, uint16_t move, bool isWhiteTurn);
+void unmakeMove(GameData& g, uint16_t move, const UndoInfo& undo);
+bool hasLegalMoves(const GameData& g, bool isWhiteTurn);
+bool isCheckmate(const GameData& g, bool isWhiteTurn);
+bool isStalemate(const GameData& g, bool isWhiteTurn);
+bool isThreefoldRepetition(const GameHistory& history, const GameData& g);
+bool isFiftyMoveDraw(const GameData& g);
+
+// ~~~~~~~~~~~~~~~~ Move Generation section ~~~~~~~~~~~~~~~~
+
+void generateMoves(const GameData& g, MoveList& list);
+void generateLegalMoves(const GameData& g, MoveList& list);
+
+// ~~~~~~~~~~~~~~~~ Hashing section ~~~~~~~~~~~~~~~~
+
+// Zobrist keys, generated at compile time in zobrist.cpp. Pieces are indexed white pawn..king (0-5),
+// then black pawn..king (6-11), in PieceType order.
+namespace Zobrist {
+    extern const std::array<std::array<uint64_t, 64>, 12> pieceKeys;
+    extern const uint64_t sideKey;
+    extern const std::array<uint64_t, 16> castlingKeys;
+    extern const std::array<uint64_t, 8> epFileKeys;
+}
+
+// The en passant file is only part of the key when a pawn of the side to move stands ready to take
+// (pseudo-legally, as in Polyglot). A double push nobody can answer en passant then hashes like any
+// other move, so the same position reached with and without one gets one key.
+inline bool epInHash(const BitBoards& b, const int epSquare, const bool isWhiteTurn) {
+    return epSquare != -1 &&
+           (MoveTables::pawnAttacks[isWhiteTurn ? 1 : 0][epSquare] & b.of(colorOf(isWhiteTurn), PieceType::Pawn));
+}
+
+uint64_t computeHash(const GameData& g);
 
 // ~~~~~~~~~~~~~~~~ Utility section ~~~~~~~~~~~~~~~~
 
 // Returns the mask for the given square
-inline uint64_t mask(const int square) {
+constexpr uint64_t mask(const int square) {
     return 1ULL << square;
 }
 
@@ -163,6 +364,33 @@ inline bool isInvalidMove(uint16_t nextMove) {
     return nextMove & 0x8000;
 }
 
+// Index of the least significant set bit (bb must be nonzero)
+inline int lsb(const uint64_t bb) {
+    return __builtin_ctzll(bb);
+}
+
+// Clears the least significant set bit of bb and returns its index
+inline int popLsb(uint64_t& bb) {
+    const int square = lsb(bb);
+    bb &= bb - 1;
+    return square;
+}
+
+// The castling rights whose king and rook are both still on their home squares. A right granted
+// without them (e.g. by a bad FEN) must never produce a castling move.
+inline int castlingRightsOnBoard(const BitBoards& b) {
+    int rights = 0;
+    if (b.wKing() & mask(4)) {
+        if (b.wRooks() & mask(7)) rights |= CASTLE_WK;
+        if (b.wRooks() & mask(0)) rights |= CASTLE_WQ;
+    }
+    if (b.bKing() & mask(60)) {
+        if (b.bRooks() & mask(63)) rights |= CASTLE_BK;
+        if (b.bRooks() & mask(56)) rights |= CASTLE_BQ;
+    }
+    return rights;
+}
+
 inline int getFile(int square) {
     return square % 8;
 }
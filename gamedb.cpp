@@ -0,0 +1,277 @@
+#include "gamedb.h"
+
+#include <algorithm>
+#include <cstring>
+
+// ~~~~~~~~~~~~~~~~ Move encoding ~~~~~~~~~~~~~~~~
+
+// Bits needed to tell count moves apart; 0 when the move is forced
+static int indexBits(const int count) {
+    int bits = 0;
+    while ((1 << bits) < count) bits++;
+    return bits;
+}
+
+// Position of move in the legal list sorted by move value, without sorting it
+static int moveRank(const MoveList& legal, const uint16_t move) {
+    int rank = 0;
+    for (const uint16_t other : legal) {
+        rank += other < move;
+    }
+    return rank;
+}
+
+// Inverse of moveRank(). Move values order by promotion, then destination, then origin, so with a
+// bitboard of origins per destination the rank is found with popcounts instead of a sort. Only
+// promotions, which sort after every other move, need an actual selection.
+static uint16_t moveAtRank(const MoveList& legal, uint32_t rank) {
+    uint64_t origins[64] = {};
+    uint16_t promotions[MAX_MOVES];
+    int promotionCount = 0;
+    for (const uint16_t move : legal) {
+        if (getPromo(move)) promotions[promotionCount++] = move;
+        else origins[getEnd(move)] |= 1ULL << getStart(move);
+    }
+
+    const uint32_t plainCount = static_cast<uint32_t>(legal.count - promotionCount);
+    if (rank >= plainCount) {
+        rank -= plainCount;
+        std::nth_element(promotions, promotions + rank, promotions + promotionCount);
+        return promotions[rank];
+    }
+    for (int end = 0;; end++) {
+        const uint32_t count = static_cast<uint32_t>(__builtin_popcountll(origins[end]));
+        if (rank < count) {
+            uint64_t bits = origins[end];
+            for (; rank > 0; rank--) bits &= bits - 1;
+            return encodeMove(lsb(bits), end, 0);
+        }
+        rank -= count;
+    }
+}
+
+static void putBits(std::vector<uint8_t>& bytes, uint64_t& bitPos, const uint32_t value, const int bits) {
+    for (int i = 0; i < bits; i++, bitPos++) {
+        if ((bitPos & 7) == 0) bytes.push_back(0);
+        if ((value >> i) & 1) bytes.back() |= static_cast<uint8_t>(1 << (bitPos & 7));
+    }
+}
+
+static uint32_t getBits(const uint8_t* bytes, uint64_t& bitPos, const int bits) {
+    uint32_t value = 0;
+    for (int i = 0; i < bits; i++, bitPos++) {
+        value |= static_cast<uint32_t>((bytes[bitPos >> 3] >> (bitPos & 7)) & 1) << i;
+    }
+    return value;
+}
+
+// Ratings above 65535 or with anything but digits are treated as missing
+static uint16_t parseElo(const std::string_view text) {
+    if (text.empty() || text.size() > 5) return 0;
+    uint32_t value = 0;
+    for (const char c : text) {
+        if (c < '0' || c > '9') return 0;
+        value = value * 10 + static_cast<uint32_t>(c - '0');
+    }
+    return value > UINT16_MAX ? 0 : static_cast<uint16_t>(value);
+}
+
+// ~~~~~~~~~~~~~~~~ Writer ~~~~~~~~~~~~~~~~
+
+GameDbWriter::~GameDbWriter() {
+    close();
+}
+
+void GameDbWriter::close() {
+    if (out) std::fclose(out);
+    if (records) std::fclose(records);
+    if (tags) std::fclose(tags);
+    out = records = tags = nullptr;
+}
+
+bool GameDbWriter::open(const char* path) {
+    close();
+    games = movesSize = tagsSize = 0;
+    failed = false;
+
+    out = std::fopen(path, "wb");
+    records = std::tmpfile();
+    tags = std::tmpfile();
+    if (!out || !records || !tags) {
+        close();
+        return false;
+    }
+    // Placeholder until finish() knows the section sizes
+    const GameDbHeader header{};
+    failed = std::fwrite(&header, sizeof(header), 1, out) != 1;
+    return !failed;
+}
+
+bool GameDbWriter::addGame(const PgnGame& game, PgnReplay& replay) {
+    if (!out) return false;
+
+    moveBits.clear();
+    uint64_t bitPos = 0;
+    MoveList legal;
+    const bool replayed = replayGame(game, replay, [&](const GameData& position, const uint16_t move) {
+        generateLegalMoves(position, legal);
+        putBits(moveBits, bitPos, static_cast<uint32_t>(moveRank(legal, move)), indexBits(legal.count));
+    });
+    if (!replayed) return false;
+    if (replay.plies > UINT16_MAX) {
+        replay.ok = false;
+        replay.error = "too many moves for a database record";
+        replay.errorToken = {};
+        replay.errorOffset = game.offset;
+        return false;
+    }
+
+    tagBytes.clear();
+    for (int i = 0; i < game.tagCount; i++) {
+        const PgnTag& tag = game.tags[i];
+        tagBytes.insert(tagBytes.end(), tag.name.begin(), tag.name.end());
+        tagBytes.push_back('\0');
+        tagBytes.insert(tagBytes.end(), tag.value.begin(), tag.value.end());
+        tagBytes.push_back('\0');
+    }
+
+    GameRecord record{};
+    record.movesOffset = movesSize;
+    record.tagOffset = tagsSize;
+    record.tagLength = static_cast<uint32_t>(tagBytes.size());
+    record.plies = static_cast<uint16_t>(replay.plies);
+    record.whiteElo = parseElo(game.tag("WhiteElo"));
+    record.blackElo = parseElo(game.tag("BlackElo"));
+    record.result = replay.result;
+    record.flags = game.tag("FEN").empty() ? 0 : GAME_FROM_FEN;
+
+    if (!moveBits.empty() && std::fwrite(moveBits.data(), 1, moveBits.size(), out) != moveBits.size()) failed = true;
+    if (!tagBytes.empty() && std::fwrite(tagBytes.data(), 1, tagBytes.size(), tags) != tagBytes.size()) failed = true;
+    if (std::fwrite(&record, sizeof(record), 1, records) != 1) failed = true;
+    movesSize += moveBits.size();
+    tagsSize += tagBytes.size();
+    games++;
+    return true;
+}
+
+// Appends the whole of a spooled temporary file to out
+static bool copySpool(std::FILE* spool, std::FILE* out) {
+    std::rewind(spool);
+    std::vector<char> buffer(1 << 20);
+    size_t read;
+    while ((read = std::fread(buffer.data(), 1, buffer.size(), spool)) > 0) {
+        if (std::fwrite(buffer.data(), 1, read, out) != read) return false;
+    }
+    return !std::ferror(spool);
+}
+
+bool GameDbWriter::finish() {
+    if (!out) return false;
+
+    GameDbHeader header{};
+    std::memcpy(header.magic, GAME_DB_MAGIC, sizeof(header.magic));
+    header.version = GAME_DB_VERSION;
+    header.recordSize = sizeof(GameRecord);
+    header.gameCount = games;
+    header.movesOffset = sizeof(GameDbHeader);
+    header.movesSize = movesSize;
+    // Records are read in place from the mapping, so they must be aligned
+    header.recordsOffset = (header.movesOffset + movesSize + 7) & ~uint64_t{7};
+    header.tagsOffset = header.recordsOffset + games * sizeof(GameRecord);
+    header.tagsSize = tagsSize;
+
+    const char padding[8] = {};
+    const size_t paddingSize = static_cast<size_t>(header.recordsOffset - header.movesOffset - movesSize);
+    if (paddingSize && std::fwrite(padding, 1, paddingSize, out) != paddingSize) failed = true;
+    if (!failed && (!copySpool(records, out) || !copySpool(tags, out))) failed = true;
+    if (!failed && (std::fseek(out, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, out) != 1)) failed = true;
+    if (std::fflush(out) != 0) failed = true;
+
+    close();
+    return !failed;
+}
+
+uint64_t GameDbWriter::bytesWritten() const {
+    const uint64_t recordsOffset = (sizeof(GameDbHeader) + movesSize + 7) & ~uint64_t{7};
+    return recordsOffset + games * sizeof(GameRecord) + tagsSize;
+}
+
+// ~~~~~~~~~~~~~~~~ Reader ~~~~~~~~~~~~~~~~
+
+bool GameDatabase::open(const char* path) {
+    header = nullptr;
+    if (!file.open(path) || file.size() < sizeof(GameDbHeader)) return false;
+
+    const auto* candidate = reinterpret_cast<const GameDbHeader*>(file.data());
+    const uint64_t size = file.size();
+    if (std::memcmp(candidate->magic, GAME_DB_MAGIC, sizeof(candidate->magic)) != 0 ||
+        candidate->version != GAME_DB_VERSION || candidate->recordSize != sizeof(GameRecord)) {
+        return false;
+    }
+    // Every section must lie inside the file, in order, with the sizes checked before any sum can overflow
+    if (candidate->movesOffset != sizeof(GameDbHeader) || candidate->movesSize > size ||
+        candidate->recordsOffset < candidate->movesOffset + candidate->movesSize || candidate->recordsOffset % 8 != 0 ||
+        candidate->gameCount > size / sizeof(GameRecord) || candidate->recordsOffset > size ||
+        candidate->tagsOffset != candidate->recordsOffset + candidate->gameCount * sizeof(GameRecord) ||
+        candidate->tagsSize > size || candidate->tagsOffset + candidate->tagsSize > size) {
+        return false;
+    }
+
+    header = candidate;
+    moves = reinterpret_cast<const uint8_t*>(file.data() + header->movesOffset);
+    records = reinterpret_cast<const GameRecord*>(file.data() + header->recordsOffset);
+    tags = file.data() + header->tagsOffset;
+    return true;
+}
+
+std::string_view GameDatabase::tag(const uint64_t index, const std::string_view name) const {
+    const GameRecord& r = records[index];
+    if (r.tagOffset > header->tagsSize || r.tagLength > header->tagsSize - r.tagOffset) return {};
+
+    // "Name\0Value\0" pairs
+    std::string_view pool(tags + r.tagOffset, r.tagLength);
+    while (!pool.empty()) {
+        const size_t nameEnd = pool.find('\0');
+        if (nameEnd == std::string_view::npos) return {};
+        const size_t valueEnd = pool.find('\0', nameEnd + 1);
+        if (valueEnd == std::string_view::npos) return {};
+        if (pool.substr(0, nameEnd) == name) return pool.substr(nameEnd + 1, valueEnd - nameEnd - 1);
+        pool.remove_prefix(valueEnd + 1);
+    }
+    return {};
+}
+
+bool GameDatabase::replay(const uint64_t index, const std::function<void(const GameData& position, uint16_t move)>& onMove,
+                          const int maxPlies) const {
+    const GameRecord& r = records[index];
+    // A game's moves run up to where the next game's begin
+    const uint64_t end = index + 1 < header->gameCount ? records[index + 1].movesOffset : header->movesSize;
+    if (r.movesOffset > end || end > header->movesSize) return false;
+
+    GameData g;
+    if (r.flags & GAME_FROM_FEN) {
+        if (!loadFEN(tag(index, "FEN"), g)) return false;
+    } else {
+        setupStartingPosition(g);
+        setupState(g);
+    }
+
+    const uint8_t* bytes = moves + r.movesOffset;
+    const uint64_t bitEnd = (end - r.movesOffset) * 8;
+    uint64_t bitPos = 0;
+    MoveList legal;
+    const int plies = std::min<int>(r.plies, maxPlies);
+    for (int ply = 0; ply < plies; ply++) {
+        generateLegalMoves(g, legal);
+        const int bits = indexBits(legal.count);
+        if (legal.count == 0 || bitPos + bits > bitEnd) return false;
+
+        const uint32_t rank = getBits(bytes, bitPos, bits);
+        if (rank >= static_cast<uint32_t>(legal.count)) return false;
+        const uint16_t move = moveAtRank(legal, rank);
+
+        if (onMove) onMove(g, move);
+        makeMove(g, move, g.state.isWhiteTurn);
+    }
+    return true;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "game.h"
+#include "mappedfile.h"
+#include "pgn.h"
+
+#include <cstdio>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~ Game database format ~~~~~~~~~~~~~~~~
+// A game database file is laid out as
+//   GameDbHeader | move streams | padding to 8 bytes | GameRecord x gameCount | tag pool
+// in native (little-endian) byte order, so the reader can use a memory mapping as is.
+//
+// Each move is stored as its rank among the legal moves of its position, sorted by move value, in
+// just enough bits to index that list: ceil(log2(legal move count)), so forced moves take no bits
+// and a typical middlegame move takes 5 or 6. The bits of one game are packed LSB first and every
+// game starts on a byte boundary. Decoding regenerates the legal moves, so the stream is only
+// meaningful together with the move generator that wrote it.
+
+constexpr char GAME_DB_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'G', 'D', 'B'};
+constexpr uint32_t GAME_DB_VERSION = 1;
+
+struct GameDbHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t gameCount;
+    uint64_t movesOffset;
+    uint64_t movesSize;
+    uint64_t recordsOffset;
+    uint64_t tagsOffset;
+    uint64_t tagsSize;
+};
+static_assert(sizeof(GameDbHeader) == 64);
+
+enum GameRecordFlags : uint8_t {
+    // The game starts from the position in its FEN tag rather than the standard start position
+    GAME_FROM_FEN = 1
+};
+
+struct GameRecord {
+    // Start of the game's moves within the move streams section
+    uint64_t movesOffset;
+    // The game's tags within the tag pool: "Name\0Value\0" pairs, values as written in the PGN
+    uint64_t tagOffset;
+    uint32_t tagLength;
+    uint16_t plies;
+    // 0 when the PGN had no rating
+    uint16_t whiteElo;
+    uint16_t blackElo;
+    GameResult result;
+    uint8_t flags;
+    uint32_t reserved;
+};
+static_assert(sizeof(GameRecord) == 32);
+
+// ~~~~~~~~~~~~~~~~ Writer ~~~~~~~~~~~~~~~~
+
+// Appends games one at a time. Move streams go straight to the output file; records and tags are
+// spooled to anonymous temporary files and copied behind the moves by finish(), so memory use
+// does not grow with the number of games.
+class GameDbWriter {
+public:
+    GameDbWriter() = default;
+    ~GameDbWriter();
+    GameDbWriter(const GameDbWriter&) = delete;
+    GameDbWriter& operator=(const GameDbWriter&) = delete;
+
+    bool open(const char* path);
+    // Replays game and stores it. Returns false (and leaves the database unchanged) when the game
+    // does not replay, with the reason in replay, or when it is longer than a record can hold.
+    bool addGame(const PgnGame& game, PgnReplay& replay);
+    // Writes the records, tag pool and header and closes the file
+    bool finish();
+
+    uint64_t gameCount() const { return games; }
+    uint64_t bytesWritten() const;
+
+private:
+    void close();
+
+    std::FILE* out = nullptr;
+    std::FILE* records = nullptr;
+    std::FILE* tags = nullptr;
+    uint64_t games = 0;
+    uint64_t movesSize = 0;
+    uint64_t tagsSize = 0;
+    // Reused between games
+    std::vector<uint8_t> moveBits;
+    std::vector<char> tagBytes;
+    bool failed = false;
+};
+
+// ~~~~~~~~~~~~~~~~ Reader ~~~~~~~~~~~~~~~~
+
+class GameDatabase {
+public:
+    // Maps path and checks its header and section bounds
+    bool open(const char* path);
+
+    uint64_t gameCount() const { return header ? header->gameCount : 0; }
+    const GameRecord& record(const uint64_t index) const { return records[index]; }
+    size_t fileSize() const { return file.size(); }
+
+    // Value of the named tag of game index, or an empty view
+    std::string_view tag(uint64_t index, std::string_view name) const;
+
+    // Replays game index through makeMove(), stopping after maxPlies moves. When given, onMove sees
+    // the position before every move. Returns false if the stored moves do not decode to legal moves.
+    bool replay(uint64_t index, const std::function<void(const GameData& position, uint16_t move)>& onMove = nullptr,
+                int maxPlies = UINT16_MAX) const;
+
+private:
+    MappedFile file;
+    const GameDbHeader* header = nullptr;
+    const GameRecord* records = nullptr;
+    const uint8_t* moves = nullptr;
+    const char* tags = nullptr;
+};
@@ -21,19 +21,24 @@ static int promotionFrom = -1;
 static int promotionTo = -1;
 static bool promotionIsWhite = true;
 
+// The game shown on the board
+static GameData game;
+static GameHistory history;
+
 bool gameOver = false;
 std::string gameOverMessage = "";
 bool showGameOverPopup = false;
 
 
 void initGUI() {
+    setupNewGame(game, history);
     loadPieceTextures();
 }
 
 void handleBoardClicks(int x, int y) {
     if (gameOver) return;
     int square = (7 - y) * 8 + x;
-    if (mask(square) & (game.state.isWhiteTurn ? game.boards.wPieces : game.boards.bPieces)) {
+    if (mask(square) & game.boards.occupancy[colorOf(game.state.isWhiteTurn)]) {
         selectedSquare = (selectedSquare == square) ? -1 : square;
     }
     else if (selectedSquare != -1) {
@@ -41,8 +46,8 @@ void handleBoardClicks(int x, int y) {
 
         uint64_t pieceMask = mask(selectedSquare);
         uint64_t destMask = mask(clickedSquare);
-        bool isWhitePawn = pieceMask & game.boards.wPawns;
-        bool isBlackPawn = pieceMask & game.boards.bPawns;
+        bool isWhitePawn = pieceMask & game.boards.wPawns();
+        bool isBlackPawn = pieceMask & game.boards.bPawns();
         bool isPromotion = (isWhitePawn && (destMask & ranks.EIGHTH_RANK)) ||
                            (isBlackPawn && (destMask & ranks.FIRST_RANK));
 
@@ -54,11 +59,10 @@ void handleBoardClicks(int x, int y) {
         }
         else {
             uint16_t nextMove = encodeMove(selectedSquare, clickedSquare, 0);
-            if (move(nextMove, game.state.isWhiteTurn)) {
+            if (move(game, history, nextMove, game.state.isWhiteTurn)) {
                 lastMoveFrom = selectedSquare;
                 lastMoveTo = clickedSquare;
                 checkGameOver();
-                game.state.isWhiteTurn = !game.state.isWhiteTurn;
             }
             // Reset selection
             selectedSquare = -1;
@@ -102,7 +106,7 @@ void drawChessboard() {
                 drawList->AddRectFilled(topLeft, bottomRight, IM_COL32(0, 128, 255, 80)); // blue
             }
 
-            char piece = getPieceAt(square);
+            char piece = getPieceAt(game, square);
             if (pieceTextures.count(piece)) {
                 ImTextureID tex = (ImTextureID)(intptr_t)pieceTextures[piece];
                 ImGui::GetWindowDrawList()->AddImage(tex, topLeft, bottomRight);
@@ -138,11 +142,9 @@ void drawChessboard() {
                 ImGui::PushID(label); // unique ID to prevent ImGui collision
                 if (ImGui::ImageButton(label, (ImTextureID)(intptr_t)pieceTextures[pieceChar], ImVec2(iconSize, iconSize))) {
                     uint16_t nextMove = encodeMove(promotionFrom, promotionTo, promoCode);
-                    if (move(nextMove, game.state.isWhiteTurn)) {
+                    if (move(game, history, nextMove, game.state.isWhiteTurn)) {
                         lastMoveFrom = promotionFrom;
                         lastMoveTo = promotionTo;
-                        game.state.isWhiteTurn = !game.state.isWhiteTurn;
-
                         checkGameOver();
                     }
                     awaitingPromotion = false;
@@ -179,15 +181,24 @@ void drawChessboard() {
     }
 }
 
+// Called after move() has passed the turn, so the side to move is the one that may be mated
 void checkGameOver() {
-    if (isCheckmate(!game.state.isWhiteTurn)) {
+    if (isCheckmate(game, game.state.isWhiteTurn)) {
         gameOver = true;
-        gameOverMessage = (game.state.isWhiteTurn ? "White" : "Black");
+        gameOverMessage = (game.state.isWhiteTurn ? "Black" : "White");
         gameOverMessage += " wins by checkmate!";
         showGameOverPopup = true;
-    } else if (isStalemate(!game.state.isWhiteTurn)) {
+    } else if (isStalemate(game, game.state.isWhiteTurn)) {
         gameOver = true;
         gameOverMessage = "Draw by stalemate.";
         showGameOverPopup = true;
+    } else if (isThreefoldRepetition(history, game)) {
+        gameOver = true;
+        gameOverMessage = "Draw by threefold repetition.";
+        showGameOverPopup = true;
+    } else if (isFiftyMoveDraw(game)) {
+        gameOver = true;
+        gameOverMessage = "Draw by the fifty-move rule.";
+        showGameOverPopup = true;
     }
 }
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// How the mapping will be read, passed on to the OS as a read-ahead hint
+enum class FileAccess {
+    Sequential, // streamed front to back, e.g. PGN and game database passes
+    Random      // probed at scattered offsets, e.g. binary searches over an index
+};
+
+// Read-only memory mapping of a whole file (mmap on POSIX, CreateFileMapping on Windows).
+// The mapping lives as long as the object, so views into it must not outlive it.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps path, replacing any earlier mapping. An empty file maps to an empty view.
+    bool open(const char* path, FileAccess access = FileAccess::Sequential);
+    void close();
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+    std::string_view view() const { return {base, length}; }
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
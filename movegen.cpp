@@ -0,0 +1,293 @@
+#include "game.h"
+
+// ~~~~~~~~~~~~~~~~ Pseudo-legal move generation section ~~~~~~~~~~~~~~~~
+
+// Adds a move from `from` to every square in targets
+static void addMoves(MoveList& list, const int from, uint64_t targets) {
+    while (targets) {
+        list.add(encodeMove(from, popLsb(targets), 0));
+    }
+}
+
+// Adds all four promotions, queen first since it is almost always the best
+static void addPromotions(MoveList& list, const int from, const int to) {
+    list.add(encodeMove(from, to, 4));
+    list.add(encodeMove(from, to, 3));
+    list.add(encodeMove(from, to, 2));
+    list.add(encodeMove(from, to, 1));
+}
+
+// Adds pawn moves landing on targets, where each target came from target - shift
+static void addPawnMoves(MoveList& list, uint64_t targets, const int shift, const uint64_t promoRank) {
+    while (targets) {
+        const int to = popLsb(targets);
+        const int from = to - shift;
+        if (mask(to) & promoRank) {
+            addPromotions(list, from, to);
+        } else {
+            list.add(encodeMove(from, to, 0));
+        }
+    }
+}
+
+// Adds pushes and captures for the given pawns, keeping only those that land on allowed squares
+static void generatePawnMoves(const bool isWhiteTurn, MoveList& list, const uint64_t pawns, const uint64_t occupied,
+                              const uint64_t enemy, const uint64_t allowed) {
+    const uint64_t empty = ~occupied;
+
+    if (isWhiteTurn) {
+        const uint64_t single = (pawns << 8) & empty;
+        const uint64_t dbl = ((single & ranks.THIRD_RANK) << 8) & empty;
+        addPawnMoves(list, single & allowed, 8, ranks.EIGHTH_RANK);
+        addPawnMoves(list, dbl & allowed, 16, 0);
+        addPawnMoves(list, ((pawns & ~files.A_FILE) << 7) & enemy & allowed, 7, ranks.EIGHTH_RANK);
+        addPawnMoves(list, ((pawns & ~files.H_FILE) << 9) & enemy & allowed, 9, ranks.EIGHTH_RANK);
+    }
+    else {
+        const uint64_t single = (pawns >> 8) & empty;
+        const uint64_t dbl = ((single & ranks.SIXTH_RANK) >> 8) & empty;
+        addPawnMoves(list, single & allowed, -8, ranks.FIRST_RANK);
+        addPawnMoves(list, dbl & allowed, -16, 0);
+        addPawnMoves(list, ((pawns & ~files.A_FILE) >> 9) & enemy & allowed, -9, ranks.FIRST_RANK);
+        addPawnMoves(list, ((pawns & ~files.H_FILE) >> 7) & enemy & allowed, -7, ranks.FIRST_RANK);
+    }
+}
+
+// Our pawns that can capture en passant are exactly the squares an enemy pawn on the ep square would attack
+static uint64_t enPassantAttackers(const GameData& g, const uint64_t pawns) {
+    if (g.state.epSquare == -1) return 0ULL;
+    return MoveTables::pawnAttacks[g.state.isWhiteTurn ? 1 : 0][g.state.epSquare] & pawns;
+}
+
+// Castling is only emitted when the king is not in check and does not pass through an attacked square,
+// so the usual "king not attacked after the move" test is enough to make it legal
+static void generateCastling(const GameData& g, MoveList& list, const uint64_t occupied) {
+    const BitBoards& b = g.boards;
+    const int rights = g.state.castling & castlingRightsOnBoard(b);
+    if (g.state.isWhiteTurn) {
+        if (!(rights & (CASTLE_WK | CASTLE_WQ)) || isSquareAttacked(4, false, b)) return;
+        if ((rights & CASTLE_WK) && !(occupied & (mask(5) | mask(6))) && !isSquareAttacked(5, false, b)) {
+            list.add(encodeMove(4, 6, 0));
+        }
+        if ((rights & CASTLE_WQ) && !(occupied & (mask(1) | mask(2) | mask(3))) && !isSquareAttacked(3, false, b)) {
+            list.add(encodeMove(4, 2, 0));
+        }
+    }
+    else {
+        if (!(rights & (CASTLE_BK | CASTLE_BQ)) || isSquareAttacked(60, true, b)) return;
+        if ((rights & CASTLE_BK) && !(occupied & (mask(61) | mask(62))) && !isSquareAttacked(61, true, b)) {
+            list.add(encodeMove(60, 62, 0));
+        }
+        if ((rights & CASTLE_BQ) && !(occupied & (mask(57) | mask(58) | mask(59))) && !isSquareAttacked(59, true, b)) {
+            list.add(encodeMove(60, 58, 0));
+        }
+    }
+}
+
+// Writes every pseudo-legal move for the side to move into list. Moves may leave the own king in check.
+void generateMoves(const GameData& g, MoveList& list) {
+    list.count = 0;
+
+    const bool isWhiteTurn = g.state.isWhiteTurn;
+    const int us = colorOf(isWhiteTurn);
+    const int them = us ^ 1;
+    const BitBoards& b = g.boards;
+    const uint64_t own = b.occupancy[us];
+    const uint64_t enemy = b.occupancy[them];
+    const uint64_t occupied = own | enemy;
+    const uint64_t targets = ~own;
+
+    uint64_t pawns = b.of(us, PieceType::Pawn);
+    generatePawnMoves(isWhiteTurn, list, pawns, occupied, enemy, ~0ULL);
+    uint64_t epAttackers = enPassantAttackers(g, pawns);
+    while (epAttackers) {
+        list.add(encodeMove(popLsb(epAttackers), g.state.epSquare, 0));
+    }
+
+    uint64_t knights = b.of(us, PieceType::Knight);
+    while (knights) {
+        const int from = popLsb(knights);
+        addMoves(list, from, MoveTables::knightMoves[from] & targets);
+    }
+
+    uint64_t bishops = b.of(us, PieceType::Bishop);
+    while (bishops) {
+        const int from = popLsb(bishops);
+        addMoves(list, from, MoveTables::getBishopAttacks(from, occupied) & targets);
+    }
+
+    uint64_t rooks = b.of(us, PieceType::Rook);
+    while (rooks) {
+        const int from = popLsb(rooks);
+        addMoves(list, from, MoveTables::getRookAttacks(from, occupied) & targets);
+    }
+
+    uint64_t queens = b.of(us, PieceType::Queen);
+    while (queens) {
+        const int from = popLsb(queens);
+        addMoves(list, from, MoveTables::getQueenAttacks(from, occupied) & targets);
+    }
+
+    uint64_t king = b.of(us, PieceType::King);
+    if (king) {
+        const int from = lsb(king);
+        addMoves(list, from, MoveTables::kingMoves[from] & targets);
+        generateCastling(g, list, occupied);
+    }
+}
+
+// ~~~~~~~~~~~~~~~~ Legal move generation section ~~~~~~~~~~~~~~~~
+
+// Every square attacked by the given side, with sliders looking through `occupied`
+static uint64_t attackedSquares(const BitBoards& b, const bool byWhite, const uint64_t occupied) {
+    uint64_t attacks = 0ULL;
+    const int side = colorOf(byWhite);
+
+    const uint64_t pawns = b.of(side, PieceType::Pawn);
+    if (byWhite) {
+        attacks |= ((pawns & ~files.A_FILE) << 7) | ((pawns & ~files.H_FILE) << 9);
+    }
+    else {
+        attacks |= ((pawns & ~files.A_FILE) >> 9) | ((pawns & ~files.H_FILE) >> 7);
+    }
+
+    uint64_t knights = b.of(side, PieceType::Knight);
+    while (knights) {
+        attacks |= MoveTables::knightMoves[popLsb(knights)];
+    }
+    uint64_t diagonal = b.of(side, PieceType::Bishop) | b.of(side, PieceType::Queen);
+    while (diagonal) {
+        attacks |= MoveTables::getBishopAttacks(popLsb(diagonal), occupied);
+    }
+    uint64_t straight = b.of(side, PieceType::Rook) | b.of(side, PieceType::Queen);
+    while (straight) {
+        attacks |= MoveTables::getRookAttacks(popLsb(straight), occupied);
+    }
+    const uint64_t king = b.of(side, PieceType::King);
+    if (king) {
+        attacks |= MoveTables::kingMoves[lsb(king)];
+    }
+    return attacks;
+}
+
+// Writes only the legal moves for the side to move into list. Checkers, pins and king danger squares
+// are computed once up front, so no candidate move has to be played to test it.
+void generateLegalMoves(const GameData& g, MoveList& list) {
+    list.count = 0;
+
+    const bool isWhiteTurn = g.state.isWhiteTurn;
+    const int us = colorOf(isWhiteTurn);
+    const int them = us ^ 1;
+    const BitBoards& b = g.boards;
+    const uint64_t own = b.occupancy[us];
+    const uint64_t enemy = b.occupancy[them];
+    const uint64_t occupied = own | enemy;
+    const uint64_t kingBB = b.of(us, PieceType::King);
+    if (!kingBB) return;
+    const int kingSquare = lsb(kingBB);
+
+    const uint64_t enemyPawns = b.of(them, PieceType::Pawn);
+    const uint64_t enemyKnights = b.of(them, PieceType::Knight);
+    const uint64_t enemyDiagonal = b.of(them, PieceType::Bishop) | b.of(them, PieceType::Queen);
+    const uint64_t enemyStraight = b.of(them, PieceType::Rook) | b.of(them, PieceType::Queen);
+
+    // King danger: the king itself is removed so it cannot hide behind its own square along a slider ray
+    const uint64_t danger = attackedSquares(b, !isWhiteTurn, occupied ^ kingBB);
+    addMoves(list, kingSquare, MoveTables::kingMoves[kingSquare] & ~own & ~danger);
+
+    const uint64_t checkers =
+        (MoveTables::pawnAttacks[isWhiteTurn ? 0 : 1][kingSquare] & enemyPawns) |
+        (MoveTables::knightMoves[kingSquare] & enemyKnights) |
+        (MoveTables::getBishopAttacks(kingSquare, occupied) & enemyDiagonal) |
+        (MoveTables::getRookAttacks(kingSquare, occupied) & enemyStraight);
+
+    // Double check: only the king can move
+    if (checkers & (checkers - 1)) return;
+
+    // Non-king moves must capture the checker or block its ray
+    uint64_t checkMask = ~0ULL;
+    if (checkers) {
+        checkMask = checkers | MoveTables::betweenMasks[kingSquare][lsb(checkers)];
+    }
+
+    // Pins: enemy sliders that would see the king through exactly one of our pieces
+    uint64_t pinned = 0ULL;
+    uint64_t snipers = (MoveTables::getBishopAttacks(kingSquare, enemy) & enemyDiagonal) |
+                       (MoveTables::getRookAttacks(kingSquare, enemy) & enemyStraight);
+    while (snipers) {
+        const uint64_t blockers = MoveTables::betweenMasks[kingSquare][popLsb(snipers)] & occupied;
+        if (blockers && !(blockers & (blockers - 1)) && (blockers & own)) {
+            pinned |= blockers;
+        }
+    }
+
+    const uint64_t targets = ~own & checkMask;
+
+    // Pawns: unpinned ones in bulk, pinned ones restricted to their pin line
+    const uint64_t pawns = b.of(us, PieceType::Pawn);
+    generatePawnMoves(isWhiteTurn, list, pawns & ~pinned, occupied, enemy, checkMask);
+    uint64_t pinnedPawns = pawns & pinned;
+    while (pinnedPawns) {
+        const int from = popLsb(pinnedPawns);
+        generatePawnMoves(isWhiteTurn, list, mask(from), occupied, enemy, checkMask & MoveTables::lineMasks[kingSquare][from]);
+    }
+
+    // En passant removes two pawns from the same rank at once, which pins alone cannot describe, so
+    // the resulting occupancy is tested directly against the enemy sliders
+    uint64_t epAttackers = enPassantAttackers(g, pawns);
+    if (epAttackers) {
+        const int epSquare = g.state.epSquare;
+        const int capturedSquare = isWhiteTurn ? epSquare - 8 : epSquare + 8;
+        if (checkMask & (mask(epSquare) | mask(capturedSquare))) {
+            while (epAttackers) {
+                const int from = popLsb(epAttackers);
+                const uint64_t after = (occupied ^ mask(from) ^ mask(capturedSquare)) | mask(epSquare);
+                if (MoveTables::getBishopAttacks(kingSquare, after) & enemyDiagonal) continue;
+                if (MoveTables::getRookAttacks(kingSquare, after) & enemyStraight) continue;
+                list.add(encodeMove(from, epSquare, 0));
+            }
+        }
+    }
+
+    uint64_t knights = b.of(us, PieceType::Knight) & ~pinned;
+    while (knights) {
+        const int from = popLsb(knights);
+        addMoves(list, from, MoveTables::knightMoves[from] & targets);
+    }
+
+    uint64_t diagonal = b.of(us, PieceType::Bishop) | b.of(us, PieceType::Queen);
+    while (diagonal) {
+        const int from = popLsb(diagonal);
+        uint64_t attacks = MoveTables::getBishopAttacks(from, occupied) & targets;
+        if (mask(from) & pinned) attacks &= MoveTables::lineMasks[kingSquare][from];
+        addMoves(list, from, attacks);
+    }
+
+    uint64_t straight = b.of(us, PieceType::Rook) | b.of(us, PieceType::Queen);
+    while (straight) {
+        const int from = popLsb(straight);
+        uint64_t attacks = MoveTables::getRookAttacks(from, occupied) & targets;
+        if (mask(from) & pinned) attacks &= MoveTables::lineMasks[kingSquare][from];
+        addMoves(list, from, attacks);
+    }
+
+    // Castling: not out of check, and not through or into an attacked square
+    if (checkers) return;
+    const int rights = g.state.castling & castlingRightsOnBoard(b);
+    if (isWhiteTurn) {
+        if ((rights & CASTLE_WK) && !(occupied & (mask(5) | mask(6))) && !(danger & (mask(5) | mask(6)))) {
+            list.add(encodeMove(4, 6, 0));
+        }
+        if ((rights & CASTLE_WQ) && !(occupied & (mask(1) | mask(2) | mask(3))) && !(danger & (mask(2) | mask(3)))) {
+            list.add(encodeMove(4, 2, 0));
+        }
+    }
+    else {
+        if ((rights & CASTLE_BK) && !(occupied & (mask(61) | mask(62))) && !(danger & (mask(61) | mask(62)))) {
+            list.add(encodeMove(60, 62, 0));
+        }
+        if ((rights & CASTLE_BQ) && !(occupied & (mask(57) | mask(58) | mask(59))) && !(danger & (mask(58) | mask(59)))) {
+            list.add(encodeMove(60, 58, 0));
+        }
+    }
+}
@@ -1,16 +1,25 @@
 #include "game.h"
 
+#include <iostream>
+
+// Every table in this file is generated by the compiler, so it is placed in read-only data and
+// is ready (and shared between engine processes through the page cache) as soon as it is mapped.
 namespace MoveTables {
-    uint64_t knightMoves[64];
-    uint64_t kingMoves[64];
-    uint64_t rookMoves[64][4096];
-    uint64_t bishopMoves[64][512];
+    bool usePext = false;
+
+    bool cpuSupportsPext() {
+#ifdef CHESS_HAS_PEXT
+        return __builtin_cpu_supports("bmi2");
+#else
+        return false;
+#endif
+    }
 
-    void initKnightMoves() {
+    constexpr std::array<uint64_t, 64> generateKnightMoves() {
+        std::array<uint64_t, 64> moves{};
         for (int sq = 0; sq < 64; sq++) {
             int x = sq % 8;
             int y = sq / 8;
-            knightMoves[sq] = 0;
 
             int dx[] = {1, 2,  2,  1, -1, -2, -2, -1};
             int dy[] = {2, 1, -1, -2, -2, -1,  1,  2};
@@ -19,16 +28,17 @@ namespace MoveTables {
                 int nx = x + dx[i];
                 int ny = y + dy[i];
                 if (nx >= 0 && nx < 8 && ny >= 0 && ny < 8) {
-                    knightMoves[sq] |= mask(ny * 8 + nx);
+                    moves[sq] |= mask(ny * 8 + nx);
                 }
             }
         }
+        return moves;
     }
-    void initKingMoves() {
+    constexpr std::array<uint64_t, 64> generateKingMoves() {
+        std::array<uint64_t, 64> moves{};
         for (int sq = 0; sq < 64; sq++) {
             int x = sq % 8;
             int y = sq / 8;
-            kingMoves[sq] = 0;
 
             for (int dx = -1; dx <= 1; dx++) {
                 for (int dy = -1; dy <= 1; dy++) {
@@ -36,45 +46,37 @@ namespace MoveTables {
                     int nx = x + dx;
                     int ny = y + dy;
                     if (nx >= 0 && nx < 8 && ny >= 0 && ny < 8) {
-                        kingMoves[sq] |= mask(ny * 8 + nx);
+                        moves[sq] |= mask(ny * 8 + nx);
                     }
                 }
             }
         }
+        return moves;
     }
+    // pawnAttacks[0] holds white pawn captures, pawnAttacks[1] black pawn captures
+    constexpr std::array<std::array<uint64_t, 64>, 2> generatePawnAttacks() {
+        std::array<std::array<uint64_t, 64>, 2> attacks{};
+        for (int sq = 0; sq < 64; sq++) {
+            int x = sq % 8;
+            int y = sq / 8;
 
-    int getBlockerIndex(uint64_t movementMask, uint64_t blockers) {
-        int index = 0;
-        int bit = 0;
-        for (int sq = 0; sq < 64; ++sq) {
-            if (movementMask & mask(sq)) {
-                if (blockers & mask(sq)) {
-                    index |= 1ULL << bit;
-                }
-                ++bit;
+            for (int dx = -1; dx <= 1; dx += 2) {
+                int nx = x + dx;
+                if (nx < 0 || nx >= 8) continue;
+                if (y < 7) attacks[0][sq] |= mask((y + 1) * 8 + nx);
+                if (y > 0) attacks[1][sq] |= mask((y - 1) * 8 + nx);
             }
         }
-        return index;
+        return attacks;
     }
-    uint64_t setBlockersFromIndex(uint64_t movementMask, int index) {
-        uint64_t blockers = 0ULL;
-        int bitPos = 0;
-
-        for (int square = 0; square < 64; ++square) {
-            if (movementMask & mask(square)) {
-                if (index & 1ULL << bitPos) {
-                    blockers |= mask(square);
-                }
-                bitPos++;
-            }
-        }
 
-        return blockers;
-    }
+    constexpr std::array<uint64_t, 64> knightMoves = generateKnightMoves();
+    constexpr std::array<uint64_t, 64> kingMoves = generateKingMoves();
+    constexpr std::array<std::array<uint64_t, 64>, 2> pawnAttacks = generatePawnAttacks();
 
     // ~~~~~~~~~~~~~~~~ Rook move generation section ~~~~~~~~~~~~~~~~
 
-    uint64_t generateRookBlockerMask(int square) {
+    constexpr uint64_t generateRookBlockerMask(int square) {
         uint64_t blockerMask = 0ULL;
         int rank = square / 8;
         int file = square % 8;
@@ -97,7 +99,7 @@ namespace MoveTables {
 
         return blockerMask;
     }
-    uint64_t computeRookAttacks(int square, uint64_t blockers) {
+    constexpr uint64_t computeRookAttacks(int square, uint64_t blockers) {
         uint64_t attacks = 0ULL;
         int rank = square / 8;
         int file = square % 8;
@@ -129,21 +131,10 @@ namespace MoveTables {
 
         return attacks;
     }
-    void initRookMoves() {
-        for (int square = 0; square < 64; square++) {
-            uint64_t mask = generateRookBlockerMask(square);
-            int numBits = __builtin_popcountll(mask);
-
-            for (int index = 0; index < (1ULL << numBits); index++) {
-                uint64_t blockers = setBlockersFromIndex(mask, index);
-                rookMoves[square][index] = computeRookAttacks(square, blockers);
-            }
-        }
-    }
 
     // ~~~~~~~~~~~~~~~~ Bishop move generation section ~~~~~~~~~~~~~~~~
 
-    uint64_t generateBishopBlockerMask(int square) {
+    constexpr uint64_t generateBishopBlockerMask(int square) {
         uint64_t blockerMask = 0ULL;
         int rank = square / 8;
         int file = square % 8;
@@ -167,7 +158,7 @@ namespace MoveTables {
 
         return blockerMask;
     }
-    uint64_t computeBishopAttacks(int square, uint64_t blockers) {
+    constexpr uint64_t computeBishopAttacks(int square, uint64_t blockers) {
         uint64_t attacks = 0ULL;
         int rank = square / 8;
         int file = square % 8;
@@ -199,22 +190,168 @@ namespace MoveTables {
 
         return attacks;
     }
-    void initBishopMoves() {
+
+    // ~~~~~~~~~~~~~~~~ Slider table section ~~~~~~~~~~~~~~~~
+
+    // Found offline by random search over sparse candidates for shift = 64 - popcount(mask)
+    constexpr uint64_t rookMagics[64] = {
+        0x8080004001847020ULL, 0x0140001000200240ULL, 0x1300200210400900ULL, 0x01800C2800100080ULL,
+        0x0600204812000430ULL, 0x0200100402000108ULL, 0x04000A1801008C50ULL, 0x1300030005604082ULL,
+        0x0400800080204008ULL, 0x0002400020005005ULL, 0x0000802000100080ULL, 0x8260801000800800ULL,
+        0x0081000500100800ULL, 0x0900800200040080ULL, 0x0000800100800200ULL, 0x0018800040800100ULL,
+        0x0000818000400062ULL, 0x0110084020004008ULL, 0x0201010010402008ULL, 0x0800808010000806ULL,
+        0x8018008080040008ULL, 0x0042008002040080ULL, 0x0040440030210842ULL, 0x0004020000810044ULL,
+        0x1580004040002000ULL, 0x1110004040002008ULL, 0x0050100080200080ULL, 0x0010100080080080ULL,
+        0x4024040080800800ULL, 0x3240040080800200ULL, 0x0107000100020004ULL, 0x000409020022C584ULL,
+        0x0221008202002040ULL, 0x2030042002400054ULL, 0x0820200041001100ULL, 0x4B40201001000902ULL,
+        0x0000100501000800ULL, 0x800A001002000805ULL, 0x0802218804001002ULL, 0x2141000045000482ULL,
+        0x080040008020800AULL, 0x0000601000414008ULL, 0x1408820040120020ULL, 0x4030000800108080ULL,
+        0x0603008040100220ULL, 0x4004002010A40108ULL, 0x0000019008440002ULL, 0xA000040080620001ULL,
+        0x0002002840850A00ULL, 0x602088400C200280ULL, 0x0018410010200100ULL, 0x0100080080100080ULL,
+        0x800800800A040080ULL, 0x0080040002008080ULL, 0x8009000200040100ULL, 0x4320042507804600ULL,
+        0x200900A010488003ULL, 0x4001004200102082ULL, 0x2423402200883082ULL, 0x9021001002200409ULL,
+        0x4052002030489472ULL, 0x0005000400080201ULL, 0x4102000400810802ULL, 0x0008108440240502ULL
+    };
+    constexpr uint64_t bishopMagics[64] = {
+        0x00C00200A4248280ULL, 0x4004100081010280ULL, 0x10C4045082000001ULL, 0x0111040085020000ULL,
+        0x04A404220001B300ULL, 0x0001012010000800ULL, 0xA402020121080000ULL, 0x1100202402084044ULL,
+        0x002404A40818490AULL, 0x000060140C006042ULL, 0x0120082A18420100ULL, 0x0000022082004404ULL,
+        0x0024011040022240ULL, 0x0004608210400080ULL, 0x0100091108024001ULL, 0x0040002412181C10ULL,
+        0x2020100802040830ULL, 0x0010008481081101ULL, 0x0201000212020600ULL, 0x030401A041408000ULL,
+        0x0008800400A08800ULL, 0x0001000600808488ULL, 0x1104140D04010401ULL, 0x2001100044008430ULL,
+        0x0110100008221098ULL, 0x01068801200D1400ULL, 0x0000248008080500ULL, 0x4404080004020408ULL,
+        0x0688840001822001ULL, 0x205082000101209DULL, 0x2054010494210100ULL, 0x1110810600232800ULL,
+        0x7604042028042082ULL, 0x08150510112004C4ULL, 0x0000280806010200ULL, 0x5008020080180080ULL,
+        0xD000460400020108ULL, 0x0010100080011050ULL, 0x0450190200032098ULL, 0x8004040040012D00ULL,
+        0x0401013130804012ULL, 0x0201080203017001ULL, 0x0001010802000104ULL, 0x40000201220B0401ULL,
+        0x800542200A000902ULL, 0x4002088905000204ULL, 0x02501401440C0040ULL, 0x8008020400448028ULL,
+        0x0010411008200480ULL, 0x80011041102800A0ULL, 0x2042110080900008ULL, 0xB000080020880910ULL,
+        0x0000114210410902ULL, 0x0402040818184024ULL, 0x0004C84808008034ULL, 0x4090141812404600ULL,
+        0x0004210042202001ULL, 0x001040840088A404ULL, 0x2100011904212400ULL, 0x1002040A02228800ULL,
+        0x2004005013020200ULL, 0x28080020A5014202ULL, 0x4208401001820880ULL, 0x6050200080808504ULL
+    };
+
+
+    constexpr std::array<uint64_t, 64> generateBlockerMasks(uint64_t (*blockerMask)(int)) {
+        std::array<uint64_t, 64> masks{};
+        for (int square = 0; square < 64; square++) {
+            masks[square] = blockerMask(square);
+        }
+        return masks;
+    }
+    constexpr std::array<int, 64> generateShifts(const std::array<uint64_t, 64>& masks) {
+        std::array<int, 64> shifts{};
         for (int square = 0; square < 64; square++) {
-            uint64_t mask = generateBishopBlockerMask(square);
-            int numBits = __builtin_popcountll(mask);
+            shifts[square] = 64 - __builtin_popcountll(masks[square]);
+        }
+        return shifts;
+    }
+    constexpr std::array<int, 64> generateOffsets(const std::array<uint64_t, 64>& masks) {
+        std::array<int, 64> offsets{};
+        int offset = 0;
+        for (int square = 0; square < 64; square++) {
+            offsets[square] = offset;
+            offset += 1 << __builtin_popcountll(masks[square]);
+        }
+        return offsets;
+    }
+
+    constexpr std::array<uint64_t, 64> rookMasks = generateBlockerMasks(generateRookBlockerMask);
+    constexpr std::array<uint64_t, 64> bishopMasks = generateBlockerMasks(generateBishopBlockerMask);
+    constexpr std::array<int, 64> rookShifts = generateShifts(rookMasks);
+    constexpr std::array<int, 64> bishopShifts = generateShifts(bishopMasks);
+    constexpr std::array<int, 64> rookOffsets = generateOffsets(rookMasks);
+    constexpr std::array<int, 64> bishopOffsets = generateOffsets(bishopMasks);
+
+    // Fills every square's slot range by walking all subsets of its blocker mask (carry-rippler).
+    // The n-th subset visited is the one _pext_u64 maps to n, so the PEXT layout stores entries in
+    // visiting order, while the magic layout stores them at (blockers * magic) >> shift.
+    template <size_t N>
+    constexpr std::array<uint64_t, N> generateSliderTable(const bool isRook, const bool pextLayout) {
+        std::array<uint64_t, N> table{};
+        for (int square = 0; square < 64; square++) {
+            const uint64_t blockerMask = isRook ? rookMasks[square] : bishopMasks[square];
+            const uint64_t magic = isRook ? rookMagics[square] : bishopMagics[square];
+            const int shift = isRook ? rookShifts[square] : bishopShifts[square];
+            const int offset = isRook ? rookOffsets[square] : bishopOffsets[square];
 
-            for (int index = 0; index < (1ULL << numBits); index++) {
-                uint64_t blockers = setBlockersFromIndex(mask, index);
-                bishopMoves[square][index] = computeBishopAttacks(square, blockers);
+            uint64_t blockers = 0ULL;
+            int index = 0;
+            do {
+                int slot = pextLayout ? index : static_cast<int>((blockers * magic) >> shift);
+                table[offset + slot] = isRook ? computeRookAttacks(square, blockers)
+                                              : computeBishopAttacks(square, blockers);
+                blockers = (blockers - blockerMask) & blockerMask;
+                index++;
+            } while (blockers);
+        }
+        return table;
+    }
+
+    constexpr std::array<uint64_t, ROOK_TABLE_SIZE> rookMoves = generateSliderTable<ROOK_TABLE_SIZE>(true, false);
+    constexpr std::array<uint64_t, BISHOP_TABLE_SIZE> bishopMoves = generateSliderTable<BISHOP_TABLE_SIZE>(false, false);
+    constexpr std::array<uint64_t, ROOK_TABLE_SIZE> rookPextMoves = generateSliderTable<ROOK_TABLE_SIZE>(true, true);
+    constexpr std::array<uint64_t, BISHOP_TABLE_SIZE> bishopPextMoves = generateSliderTable<BISHOP_TABLE_SIZE>(false, true);
+
+    // ~~~~~~~~~~~~~~~~ Alignment table section ~~~~~~~~~~~~~~~~
+
+    // Squares strictly between a and b when they share a rank, file or diagonal, 0 otherwise
+    constexpr std::array<std::array<uint64_t, 64>, 64> generateBetweenMasks() {
+        std::array<std::array<uint64_t, 64>, 64> between{};
+        for (int a = 0; a < 64; a++) {
+            for (int b = 0; b < 64; b++) {
+                if (computeRookAttacks(a, 0ULL) & mask(b)) {
+                    between[a][b] = computeRookAttacks(a, mask(b)) & computeRookAttacks(b, mask(a));
+                }
+                else if (computeBishopAttacks(a, 0ULL) & mask(b)) {
+                    between[a][b] = computeBishopAttacks(a, mask(b)) & computeBishopAttacks(b, mask(a));
+                }
+            }
+        }
+        return between;
+    }
+    // The whole line (edge to edge) through a and b when they are aligned, 0 otherwise
+    constexpr std::array<std::array<uint64_t, 64>, 64> generateLineMasks() {
+        std::array<std::array<uint64_t, 64>, 64> lines{};
+        for (int a = 0; a < 64; a++) {
+            for (int b = 0; b < 64; b++) {
+                if (computeRookAttacks(a, 0ULL) & mask(b)) {
+                    lines[a][b] = (computeRookAttacks(a, 0ULL) & computeRookAttacks(b, 0ULL)) | mask(a) | mask(b);
+                }
+                else if (computeBishopAttacks(a, 0ULL) & mask(b)) {
+                    lines[a][b] = (computeBishopAttacks(a, 0ULL) & computeBishopAttacks(b, 0ULL)) | mask(a) | mask(b);
+                }
             }
         }
+        return lines;
     }
 
+    constexpr std::array<std::array<uint64_t, 64>, 64> betweenMasks = generateBetweenMasks();
+    constexpr std::array<std::array<uint64_t, 64>, 64> lineMasks = generateLineMasks();
+
+    static_assert(rookOffsets[63] + (1 << (64 - rookShifts[63])) == ROOK_TABLE_SIZE);
+    static_assert(bishopOffsets[63] + (1 << (64 - bishopShifts[63])) == BISHOP_TABLE_SIZE);
+
     void init() {
-        initKnightMoves();
-        initKingMoves();
-        initRookMoves();
-        initBishopMoves();
+        // The tables for both backends are prebuilt; only the indexing scheme is picked here
+        usePext = cpuSupportsPext();
+    }
+
+    // Bytes of attack tables the active backend actually touches (the other slider layout stays
+    // in the image but is never paged in)
+    size_t memoryFootprint() {
+        return sizeof(knightMoves) + sizeof(kingMoves) + sizeof(pawnAttacks) +
+               sizeof(betweenMasks) + sizeof(lineMasks) +
+               sizeof(rookMoves) + sizeof(bishopMoves) +
+               sizeof(rookOffsets) + sizeof(bishopOffsets) +
+               sizeof(rookMasks) + sizeof(bishopMasks) +
+               (usePext ? 0 : sizeof(rookMagics) + sizeof(bishopMagics) + sizeof(rookShifts) + sizeof(bishopShifts));
+    }
+
+    void printDiagnostics() {
+        std::cerr << "MoveTables: " << (usePext ? "PEXT" : "magic") << " slider indexing, "
+                  << memoryFootprint() / 1024 << " KB of attack tables (rook "
+                  << sizeof(rookMoves) / 1024 << " KB, bishop "
+                  << sizeof(bishopMoves) / 1024 << " KB)\n";
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,285 @@
+#include "perft.h"
+#include "threadpool.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+const PerftPosition perftSuite[] = {
+    {"Start position", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        {20, 400, 8902, 197281, 4865609, 119060324, 0}},
+    {"Kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        {48, 2039, 97862, 4085603, 193690690, 0}},
+    {"Position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        {14, 191, 2812, 43238, 674624, 11030083, 178633661, 0}},
+    {"Position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        {6, 264, 9467, 422333, 15833292, 0}},
+    {"Position 4 (mirrored)", "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+        {6, 264, 9467, 422333, 15833292, 0}},
+    {"Position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        {44, 1486, 62379, 2103487, 89941194, 0}},
+    {"Position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        {46, 2079, 89890, 3894594, 164075551, 0}},
+    // En passant squares the board contradicts must be dropped on load: no pawn to take on e4, and
+    // a knight standing on e3. Counts are those of the same FENs with "-".
+    {"Bad en passant (no pawn)", "4k3/8/8/8/3p4/8/8/4K3 b - e3 0 1",
+        {6, 29, 218, 1274, 9906, 0}},
+    {"Bad en passant (occupied)", "4k3/8/8/8/3pP3/4N3/8/4K3 b - e3 0 1",
+        {7, 87, 649, 7616, 55100, 0}},
+};
+const int perftSuiteSize = sizeof(perftSuite) / sizeof(perftSuite[0]);
+
+// Walks the tree on a single GameData, taking every move back on the way up
+static uint64_t perftMakeUnmake(GameData& g, const int depth) {
+    MoveList moves;
+    generateLegalMoves(g, moves);
+    // Bulk counting: the legal move count is the leaf count one ply above the leaves
+    if (depth <= 1) return depth == 1 ? moves.count : 1;
+
+    uint64_t nodes = 0;
+    for (const uint16_t move : moves) {
+        const UndoInfo undo = makeMove(g, move, g.state.isWhiteTurn);
+        nodes += perftMakeUnmake(g, depth - 1);
+        unmakeMove(g, move, undo);
+    }
+    return nodes;
+}
+
+uint64_t perft(const GameData& g, const int depth) {
+    GameData position = g;
+    return perftMakeUnmake(position, depth);
+}
+
+uint64_t perftCopyMake(const GameData& g, const int depth) {
+    MoveList moves;
+    generateLegalMoves(g, moves);
+    if (depth <= 1) return depth == 1 ? moves.count : 1;
+
+    uint64_t nodes = 0;
+    for (const uint16_t move : moves) {
+        GameData child = g;
+        makeMove(child, move, g.state.isWhiteTurn);
+        nodes += perftCopyMake(child, depth - 1);
+    }
+    return nodes;
+}
+
+PerftCache::PerftCache(const size_t megabytes) {
+    // Round down to a power of two so a slot is a mask away
+    const size_t requested = megabytes * 1024 * 1024 / sizeof(Entry);
+    entryCount = 1;
+    while (entryCount * 2 <= requested) entryCount *= 2;
+    entries = std::make_unique<Entry[]>(entryCount);
+    for (size_t i = 0; i < entryCount; i++) {
+        entries[i].check.store(0, std::memory_order_relaxed);
+        entries[i].data.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Mixing the depth in keeps the counts for one position at different depths in different slots
+size_t PerftCache::slot(const uint64_t key, const int depth) const {
+    return (key ^ (static_cast<uint64_t>(depth) * 0x9E3779B97F4A7C15ULL)) & (entryCount - 1);
+}
+
+// data packs the node count above an 8-bit depth; depth 0 marks an empty entry
+bool PerftCache::probe(const uint64_t key, const int depth, uint64_t& nodes) {
+    const Entry& entry = entries[slot(key, depth)];
+    const uint64_t data = entry.data.load(std::memory_order_relaxed);
+    const uint64_t check = entry.check.load(std::memory_order_relaxed);
+    if ((check ^ data) != key || static_cast<int>(data & 0xFF) != depth) return false;
+    nodes = data >> 8;
+    return true;
+}
+
+void PerftCache::store(const uint64_t key, const int depth, const uint64_t nodes) {
+    Entry& entry = entries[slot(key, depth)];
+    const uint64_t data = (nodes << 8) | static_cast<uint64_t>(depth & 0xFF);
+    entry.check.store(key ^ data, std::memory_order_relaxed);
+    entry.data.store(data, std::memory_order_relaxed);
+}
+
+void PerftCache::addStats(const uint64_t probes, const uint64_t hits) {
+    probeCount.fetch_add(probes, std::memory_order_relaxed);
+    hitCount.fetch_add(hits, std::memory_order_relaxed);
+}
+
+struct PerftCacheStats {
+    uint64_t probes = 0;
+    uint64_t hits = 0;
+};
+
+static uint64_t perftHashed(GameData& g, const int depth, PerftCache& cache, PerftCacheStats& stats) {
+    // Below depth 2 the bulk count is cheaper than a cache probe
+    if (depth < 2) return perftMakeUnmake(g, depth);
+
+    const uint64_t key = g.state.hash;
+    uint64_t nodes = 0;
+    stats.probes++;
+    if (cache.probe(key, depth, nodes)) {
+        stats.hits++;
+        return nodes;
+    }
+
+    MoveList moves;
+    generateLegalMoves(g, moves);
+    for (const uint16_t move : moves) {
+        const UndoInfo undo = makeMove(g, move, g.state.isWhiteTurn);
+        nodes += perftHashed(g, depth - 1, cache, stats);
+        unmakeMove(g, move, undo);
+    }
+    cache.store(key, depth, nodes);
+    return nodes;
+}
+
+uint64_t perftHashed(const GameData& g, const int depth, PerftCache& cache) {
+    PerftCacheStats stats;
+    GameData position = g;
+    const uint64_t nodes = perftHashed(position, depth, cache, stats);
+    cache.addStats(stats.probes, stats.hits);
+    return nodes;
+}
+
+uint64_t divide(const GameData& g, const int depth) {
+    MoveList moves;
+    generateLegalMoves(g, moves);
+
+    GameData position = g;
+    uint64_t nodes = 0;
+    for (const uint16_t move : moves) {
+        const UndoInfo undo = makeMove(position, move, position.state.isWhiteTurn);
+        const uint64_t count = perftMakeUnmake(position, depth - 1);
+        unmakeMove(position, move, undo);
+        nodes += count;
+
+        char lan[MAX_SAN_LENGTH];
+        moveToLAN(move, lan);
+        std::cout << lan << ": " << count << "\n";
+    }
+    std::cout << "\nMoves: " << moves.count << "\n";
+    return nodes;
+}
+
+struct PerftTask {
+    GameData position;
+    int depth;
+};
+
+// Expands g splitDepth plies deep, turning every node reached into a task for the remaining depth
+static void collectTasks(const GameData& g, const int splitDepth, const int depth, std::vector<PerftTask>& tasks) {
+    if (splitDepth == 0) {
+        tasks.push_back({g, depth});
+        return;
+    }
+    MoveList moves;
+    generateLegalMoves(g, moves);
+    for (const uint16_t move : moves) {
+        GameData child = g;
+        makeMove(child, move, g.state.isWhiteTurn);
+        collectTasks(child, splitDepth - 1, depth - 1, tasks);
+    }
+}
+
+uint64_t perftParallel(const GameData& g, const int depth, const int threads, int splitDepth, PerftCache* cache) {
+    // Leave at least one ply for the tasks themselves
+    if (splitDepth > depth - 1) splitDepth = depth - 1;
+    if (threads <= 1 || splitDepth < 1) return cache ? perftHashed(g, depth, *cache) : perft(g, depth);
+
+    std::vector<PerftTask> tasks;
+    collectTasks(g, splitDepth, depth, tasks);
+
+    // One counter per worker, each on its own cache line, summed once all tasks are done
+    struct alignas(64) Counter {
+        uint64_t nodes = 0;
+    };
+    std::vector<Counter> counters(threads);
+    runWorkStealing(tasks.size(), threads, [&](const int worker, const size_t index) {
+        const PerftTask& task = tasks[index];
+        counters[worker].nodes += cache ? perftHashed(task.position, task.depth, *cache) : perft(task.position, task.depth);
+    });
+
+    uint64_t nodes = 0;
+    for (const Counter& counter : counters) {
+        nodes += counter.nodes;
+    }
+    return nodes;
+}
+
+void reportScaling(const GameData& g, const int depth, const int threads, const int splitDepth) {
+    auto start = std::chrono::steady_clock::now();
+    const uint64_t serialNodes = perft(g, depth);
+    const double serialSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    const uint64_t parallelNodes = perftParallel(g, depth, threads, splitDepth);
+    const double parallelSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const double speedup = serialSeconds / (parallelSeconds > 0 ? parallelSeconds : 1e-9);
+    std::cout << "1 thread:  " << serialNodes << " nodes, " << serialSeconds * 1000.0 << " ms\n"
+              << threads << " threads: " << parallelNodes << " nodes, " << parallelSeconds * 1000.0 << " ms\n"
+              << "Speedup: " << speedup << "x, efficiency: " << speedup / threads * 100.0 << "%\n";
+    if (serialNodes != parallelNodes) {
+        std::cout << "Node counts differ!\n";
+    }
+}
+
+void compareMakeStrategies(const GameData& g, const int depth) {
+    auto start = std::chrono::steady_clock::now();
+    const uint64_t copyNodes = perftCopyMake(g, depth);
+    const double copySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    const uint64_t unmakeNodes = perft(g, depth);
+    const double unmakeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Copy-make:   " << copyNodes << " nodes, " << copySeconds * 1000.0 << " ms, "
+              << static_cast<uint64_t>(copyNodes / (copySeconds > 0 ? copySeconds : 1e-9)) << " nps\n"
+              << "Make/unmake: " << unmakeNodes << " nodes, " << unmakeSeconds * 1000.0 << " ms, "
+              << static_cast<uint64_t>(unmakeNodes / (unmakeSeconds > 0 ? unmakeSeconds : 1e-9)) << " nps\n";
+    if (copyNodes != unmakeNodes) {
+        std::cout << "Node counts differ!\n";
+    }
+}
+
+void printCacheStats(const PerftCache& cache) {
+    const uint64_t probes = cache.probes();
+    std::cout << "Perft cache: " << cache.sizeInBytes() / (1024 * 1024) << " MB, " << probes << " probes, "
+              << cache.hits() << " hits (" << (probes ? 100.0 * cache.hits() / probes : 0.0) << "% hit rate)\n";
+}
+
+bool runPerftSuite(const int maxDepth, const int threads, const int splitDepth, PerftCache* cache) {
+    bool allPassed = true;
+    uint64_t totalNodes = 0;
+    double totalSeconds = 0.0;
+
+    for (int i = 0; i < perftSuiteSize; i++) {
+        const PerftPosition& position = perftSuite[i];
+        GameData g;
+        if (!loadFEN(position.fen, g)) {
+            std::cout << position.name << ": bad FEN\n";
+            allPassed = false;
+            continue;
+        }
+
+        std::cout << position.name << "\n";
+        for (int depth = 1; depth <= maxDepth && position.expected[depth - 1] != 0; depth++) {
+            const auto start = std::chrono::steady_clock::now();
+            const uint64_t nodes = threads > 1 || cache ? perftParallel(g, depth, threads, splitDepth, cache) : perft(g, depth);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const bool passed = nodes == position.expected[depth - 1];
+            allPassed &= passed;
+            totalNodes += nodes;
+            totalSeconds += seconds;
+
+            std::cout << "  depth " << depth << ": " << nodes << " nodes, " << seconds * 1000.0 << " ms, "
+                      << static_cast<uint64_t>(nodes / (seconds > 0 ? seconds : 1e-9)) << " nps";
+            if (!passed) std::cout << "  FAILED, expected " << position.expected[depth - 1];
+            std::cout << "\n";
+        }
+    }
+
+    std::cout << "\nTotal: " << totalNodes << " nodes in " << totalSeconds << " s, "
+              << static_cast<uint64_t>(totalNodes / (totalSeconds > 0 ? totalSeconds : 1e-9)) << " nps\n"
+              << (allPassed ? "All perft counts match.\n" : "Perft MISMATCH.\n");
+    if (cache) printCacheStats(*cache);
+    return allPassed;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "game.h"
+
+#include <atomic>
+#include <memory>
+
+// Transposition cache for perft, keyed by position hash and depth, shared between threads without locks.
+// Each entry stores (key ^ data, data); a torn write from two racing threads fails the XOR check on
+// probe and is treated as a miss, so no locking is needed.
+class PerftCache {
+public:
+    explicit PerftCache(size_t megabytes);
+
+    bool probe(uint64_t key, int depth, uint64_t& nodes);
+    void store(uint64_t key, int depth, uint64_t nodes);
+
+    // Probe/hit counts are gathered per worker and added here once per task
+    void addStats(uint64_t probes, uint64_t hits);
+    uint64_t probes() const { return probeCount.load(); }
+    uint64_t hits() const { return hitCount.load(); }
+    size_t sizeInBytes() const { return entryCount * sizeof(Entry); }
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> check;
+        std::atomic<uint64_t> data;
+    };
+
+    size_t slot(uint64_t key, int depth) const;
+
+    std::unique_ptr<Entry[]> entries;
+    size_t entryCount;
+    std::atomic<uint64_t> probeCount{0};
+    std::atomic<uint64_t> hitCount{0};
+};
+
+// Counts the leaf nodes of the legal move tree below g, depth plies deep. Works on one copy of g
+// with makeMove()/unmakeMove().
+uint64_t perft(const GameData& g, int depth);
+
+// perft() that copies the position for every child instead of unmaking, kept as a benchmark baseline
+uint64_t perftCopyMake(const GameData& g, int depth);
+
+// perft() that looks up and stores subtree counts of depth >= 2 in cache
+uint64_t perftHashed(const GameData& g, int depth, PerftCache& cache);
+
+// perft() split by root move, printing the count under each move
+uint64_t divide(const GameData& g, int depth);
+
+// perft() on `threads` workers: the tree is expanded splitDepth plies deep and every resulting
+// subtree becomes a task for a work-stealing pool. Each task carries its own GameData copy.
+// All workers share cache when one is given.
+uint64_t perftParallel(const GameData& g, int depth, int threads, int splitDepth, PerftCache* cache = nullptr);
+
+void printCacheStats(const PerftCache& cache);
+
+// Times perftCopyMake() against perft() on the same position
+void compareMakeStrategies(const GameData& g, int depth);
+
+// Times perft() against perftParallel() and prints speedup and scaling efficiency (speedup / threads)
+void reportScaling(const GameData& g, int depth, int threads, int splitDepth);
+
+struct PerftPosition {
+    const char* name;
+    const char* fen;
+    // Published node counts; expected[d - 1] is the count at depth d, 0 terminates the list
+    uint64_t expected[8];
+};
+
+extern const PerftPosition perftSuite[];
+extern const int perftSuiteSize;
+
+// Runs every suite position up to min(maxDepth, deepest known count), printing nodes, time and NPS.
+// Uses perftParallel() when threads > 1 or a cache is given. Returns true if every count matched.
+bool runPerftSuite(int maxDepth, int threads = 1, int splitDepth = 2, PerftCache* cache = nullptr);
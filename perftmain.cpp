@@ -0,0 +1,92 @@
+#include "perft.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Usage:
+//   perft [options]                          run the reference suite
+//   perft [options] suite [maxDepth]         run the reference suite, capped at maxDepth
+//   perft [options] <depth> [fen]            count nodes from fen (start position by default)
+//   perft divide <depth> [fen]               same, split by root move
+//   perft [options] scaling <depth> [fen]    compare single-threaded and parallel runs
+//   perft makebench <depth> [fen]            compare copy-make and make/unmake
+// Options:
+//   --threads N   worker threads (default 1; 0 = all hardware threads)
+//   --split D     plies expanded before handing subtrees to workers (default 2)
+//   --hash MB     share a perft cache of this size between all workers (default off)
+int main(int argc, char** argv) {
+    setup();
+
+    int threads = 1;
+    int splitDepth = 2;
+    int hashMegabytes = 0;
+    std::vector<const char*> args;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--split") == 0 && i + 1 < argc) {
+            splitDepth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+            hashMegabytes = atoi(argv[++i]);
+        }
+        else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads <= 0) threads = 1;
+    }
+
+    std::unique_ptr<PerftCache> cache;
+    if (hashMegabytes > 0) {
+        cache = std::make_unique<PerftCache>(hashMegabytes);
+    }
+
+    if (args.empty() || strcmp(args[0], "suite") == 0) {
+        const int maxDepth = args.size() > 1 ? atoi(args[1]) : 8;
+        return runPerftSuite(maxDepth, threads, splitDepth, cache.get()) ? 0 : 1;
+    }
+
+    const bool isDivide = strcmp(args[0], "divide") == 0;
+    const bool isScaling = strcmp(args[0], "scaling") == 0;
+    const bool isMakeBench = strcmp(args[0], "makebench") == 0;
+    const size_t argBase = isDivide || isScaling || isMakeBench ? 1 : 0;
+    if (args.size() <= argBase) {
+        std::cout << "Missing depth.\n";
+        return 1;
+    }
+    const int depth = atoi(args[argBase]);
+
+    GameData g;
+    setupStartingPosition(g);
+    setupState(g);
+    if (args.size() > argBase + 1 && !loadFEN(args[argBase + 1], g)) {
+        std::cout << "Invalid FEN.\n";
+        return 1;
+    }
+
+    if (isScaling) {
+        reportScaling(g, depth, threads, splitDepth);
+        return 0;
+    }
+    if (isMakeBench) {
+        compareMakeStrategies(g, depth);
+        return 0;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t nodes = isDivide ? divide(g, depth) : perftParallel(g, depth, threads, splitDepth, cache.get());
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Nodes: " << nodes << "\nTime: " << seconds * 1000.0 << " ms\nNPS: "
+              << static_cast<uint64_t>(nodes / (seconds > 0 ? seconds : 1e-9)) << "\n";
+    if (cache) printCacheStats(*cache);
+    return 0;
+}
@@ -0,0 +1,363 @@
+#include "pgn.h"
+#include "threadpool.h"
+
+#include <algorithm>
+
+// ~~~~~~~~~~~~~~~~ Tokenizer ~~~~~~~~~~~~~~~~
+
+static bool isSpace(const char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Characters that end a symbol (move, move number or result) and start a token of their own
+static bool isDelimiter(const char c) {
+    return isSpace(c) || c == '{' || c == '}' || c == '(' || c == ')' || c == '[' || c == ']' ||
+           c == ';' || c == '$' || c == '"';
+}
+
+static bool isDigit(const char c) {
+    return c >= '0' && c <= '9';
+}
+
+PgnToken PgnTokenizer::next() {
+    while (true) {
+        while (pos < input.size() && isSpace(input[pos])) pos++;
+        if (pos >= input.size()) return {};
+
+        // UTF-8 byte order mark at the start of the file
+        if (pos == 0 && input.substr(0, 3) == "\xEF\xBB\xBF") {
+            pos = 3;
+            continue;
+        }
+        // Escape lines start with '%' in the first column and are ignored entirely
+        if (input[pos] == '%' && (pos == 0 || input[pos - 1] == '\n')) {
+            while (pos < input.size() && input[pos] != '\n') pos++;
+            continue;
+        }
+        break;
+    }
+
+    const size_t start = pos;
+    PgnToken token;
+    switch (input[pos]) {
+        case '[':
+            return readTag();
+        case '{': {
+            const size_t close = input.find('}', pos);
+            if (close == std::string_view::npos) {
+                pos = input.size();
+                token.type = PgnTokenType::Invalid;
+            } else {
+                pos = close + 1;
+                token.type = PgnTokenType::Comment;
+            }
+            token.text = input.substr(start, pos - start);
+            return token;
+        }
+        case ';': {
+            const size_t eol = input.find('\n', pos);
+            pos = eol == std::string_view::npos ? input.size() : eol;
+            token.type = PgnTokenType::Comment;
+            token.text = input.substr(start, pos - start);
+            return token;
+        }
+        case '(':
+        case ')':
+            token.type = input[pos] == '(' ? PgnTokenType::VariationStart : PgnTokenType::VariationEnd;
+            token.text = input.substr(pos++, 1);
+            return token;
+        case '$':
+            pos++;
+            while (pos < input.size() && isDigit(input[pos])) pos++;
+            token.type = pos - start > 1 ? PgnTokenType::Nag : PgnTokenType::Invalid;
+            token.text = input.substr(start, pos - start);
+            return token;
+        default:
+            break;
+    }
+
+    while (pos < input.size() && !isDelimiter(input[pos])) pos++;
+    std::string_view symbol = input.substr(start, pos - start);
+    if (symbol.empty()) {
+        // A lone delimiter that starts nothing, e.g. a stray '}' or ']'
+        token.type = PgnTokenType::Invalid;
+        token.text = input.substr(pos++, 1);
+        return token;
+    }
+
+    if (symbol == "1-0" || symbol == "0-1" || symbol == "1/2-1/2" || symbol == "*") {
+        token.type = PgnTokenType::Result;
+    }
+    else if ((isDigit(symbol[0]) && symbol.substr(0, 3) != "0-0") || symbol[0] == '.') {
+        // "12.", "12...", or "12.e4" written without a space, in which case the move is the next token
+        size_t end = 0;
+        while (end < symbol.size() && isDigit(symbol[end])) end++;
+        while (end < symbol.size() && symbol[end] == '.') end++;
+        symbol = symbol.substr(0, end);
+        pos = start + end;
+        token.type = PgnTokenType::MoveNumber;
+    }
+    else {
+        token.type = PgnTokenType::Move;
+    }
+    token.text = symbol;
+    return token;
+}
+
+// [Name "Value"], where the value may contain \" and \\ escapes
+PgnToken PgnTokenizer::readTag() {
+    const size_t start = pos;
+    PgnToken token;
+    token.type = PgnTokenType::Invalid;
+
+    pos++;
+    while (pos < input.size() && isSpace(input[pos])) pos++;
+    const size_t nameStart = pos;
+    while (pos < input.size() && !isDelimiter(input[pos])) pos++;
+    token.name = input.substr(nameStart, pos - nameStart);
+    while (pos < input.size() && isSpace(input[pos])) pos++;
+
+    if (!token.name.empty() && pos < input.size() && input[pos] == '"') {
+        const size_t valueStart = ++pos;
+        while (pos < input.size() && input[pos] != '"' && input[pos] != '\n') {
+            pos += input[pos] == '\\' ? 2 : 1;
+        }
+        if (pos < input.size() && input[pos] == '"') {
+            token.value = input.substr(valueStart, pos - valueStart);
+            pos++;
+            while (pos < input.size() && isSpace(input[pos])) pos++;
+            if (pos < input.size() && input[pos] == ']') {
+                pos++;
+                token.type = PgnTokenType::Tag;
+                token.text = input.substr(start, pos - start);
+                return token;
+            }
+        }
+    }
+
+    // Malformed: give up on the rest of the line
+    pos = std::min(input.find('\n', start), input.size());
+    token.text = input.substr(start, pos - start);
+    return token;
+}
+
+// ~~~~~~~~~~~~~~~~ Games ~~~~~~~~~~~~~~~~
+
+GameResult parseResult(const std::string_view text) {
+    if (text == "1-0") return GameResult::WhiteWins;
+    if (text == "0-1") return GameResult::BlackWins;
+    if (text == "1/2-1/2") return GameResult::Draw;
+    return GameResult::Unknown;
+}
+
+std::string_view PgnGame::tag(const std::string_view name) const {
+    for (int i = 0; i < tagCount; i++) {
+        if (tags[i].name == name) return tags[i].value;
+    }
+    return {};
+}
+
+bool PgnReader::next(PgnGame& game) {
+    PgnTokenizer probe = tokens;
+    PgnToken token = probe.next();
+    if (token.type == PgnTokenType::End) return false;
+
+    game.tagCount = 0;
+    game.offset = static_cast<size_t>(token.text.data() - input.data());
+    const char* end = token.text.data();
+
+    while (token.type == PgnTokenType::Tag) {
+        if (game.tagCount < MAX_PGN_TAGS) {
+            game.tags[game.tagCount++] = {token.name, token.value};
+        }
+        end = token.text.data() + token.text.size();
+        tokens = probe;
+        token = probe.next();
+    }
+
+    // Movetext runs to the result at variation depth 0, or up to the next game's first tag
+    const char* movetextStart = token.type == PgnTokenType::End ? end : token.text.data();
+    int depth = 0;
+    while (token.type != PgnTokenType::End && token.type != PgnTokenType::Tag) {
+        end = token.text.data() + token.text.size();
+        tokens = probe;
+        if (token.type == PgnTokenType::VariationStart) depth++;
+        if (token.type == PgnTokenType::VariationEnd && depth > 0) depth--;
+        if (token.type == PgnTokenType::Result && depth == 0) break;
+        token = probe.next();
+    }
+
+    const char* gameStart = input.data() + game.offset;
+    game.text = std::string_view(gameStart, static_cast<size_t>(end - gameStart));
+    game.movetext = std::string_view(movetextStart, static_cast<size_t>(end - movetextStart));
+    return true;
+}
+
+// ~~~~~~~~~~~~~~~~ Replay ~~~~~~~~~~~~~~~~
+
+static bool replayFailed(const PgnGame& game, PgnReplay& replay, const char* error, const std::string_view token) {
+    replay.ok = false;
+    replay.error = error;
+    replay.errorToken = token;
+    replay.errorOffset = game.offset + static_cast<size_t>(token.data() - game.text.data());
+    return false;
+}
+
+bool replayGame(const PgnGame& game, PgnReplay& replay,
+                const std::function<void(const GameData& position, uint16_t move)>& onMove) {
+    replay = PgnReplay{};
+
+    GameData g;
+    const std::string_view fen = game.tag("FEN");
+    if (fen.empty()) {
+        setupStartingPosition(g);
+        setupState(g);
+    } else if (!loadFEN(fen, g)) {
+        return replayFailed(game, replay, "invalid FEN tag", fen);
+    }
+
+    PgnTokenizer tokens(game.movetext);
+    int depth = 0;
+    for (PgnToken token = tokens.next(); token.type != PgnTokenType::End; token = tokens.next()) {
+        switch (token.type) {
+            case PgnTokenType::VariationStart:
+                depth++;
+                break;
+            case PgnTokenType::VariationEnd:
+                if (depth == 0) return replayFailed(game, replay, "unbalanced ')'", token.text);
+                depth--;
+                break;
+            case PgnTokenType::Move: {
+                // Variation moves belong to other positions; only the main line is replayed
+                if (depth > 0) break;
+                const uint16_t move = parseSAN(g, token.text);
+                if (isInvalidMove(move)) return replayFailed(game, replay, "illegal or ambiguous move", token.text);
+                if (onMove) onMove(g, move);
+                makeMove(g, move, g.state.isWhiteTurn);
+                replay.plies++;
+                break;
+            }
+            case PgnTokenType::Result:
+                if (depth == 0) replay.result = parseResult(token.text);
+                break;
+            case PgnTokenType::Tag:
+            case PgnTokenType::Invalid:
+                return replayFailed(game, replay, "unexpected token", token.text);
+            default:
+                break;
+        }
+    }
+    if (depth != 0) return replayFailed(game, replay, "unterminated variation", game.movetext.substr(game.movetext.size()));
+
+    if (replay.result == GameResult::Unknown) {
+        replay.result = parseResult(game.tag("Result"));
+    }
+    replay.ok = true;
+    return true;
+}
+
+// ~~~~~~~~~~~~~~~~ Parallel ingestion ~~~~~~~~~~~~~~~~
+
+// True when the line starting at lineStart is a tag line whose previous non-blank line is not
+static bool opensTagSection(const std::string_view input, const size_t lineStart) {
+    if (input[lineStart] != '[') return false;
+    size_t pos = lineStart;
+    while (pos > 0 && isSpace(input[pos - 1])) pos--;
+    if (pos == 0) return true;
+
+    const size_t previousLine = input.rfind('\n', pos - 1);
+    size_t first = previousLine == std::string_view::npos ? 0 : previousLine + 1;
+    while (first < pos && isSpace(input[first])) first++;
+    return input[first] != '[';
+}
+
+// True when pos lies inside a {...} comment, given that start does not. Comments do not nest and
+// the first '}' ends one, so that is exactly when the last brace between them is a '{'. A brace in
+// a ';' comment or a tag value can only make this answer true wrongly, which merely moves a cut later.
+static bool insideComment(const std::string_view input, const size_t start, const size_t pos) {
+    const size_t brace = input.substr(start, pos - start).find_last_of("{}");
+    return brace != std::string_view::npos && input[start + brace] == '{';
+}
+
+// True when the line starting at lineStart begins with a well-formed [Name "Value"] pair, which is
+// what the reader takes as the start of a new game
+static bool startsWithTag(const std::string_view input, const size_t lineStart) {
+    PgnTokenizer tokens(input.substr(lineStart));
+    return tokens.next().type == PgnTokenType::Tag;
+}
+
+std::vector<std::string_view> splitPgnChunks(const std::string_view input, const size_t chunkBytes) {
+    std::vector<std::string_view> chunks;
+    size_t start = 0;
+    while (start < input.size()) {
+        size_t cut = start + std::max<size_t>(chunkBytes, 1);
+        if (cut >= input.size()) {
+            chunks.push_back(input.substr(start));
+            break;
+        }
+
+        // First game that starts at or after the target size
+        size_t newline = input.find("\n[", cut - 1);
+        while (newline != std::string_view::npos) {
+            const size_t line = newline + 1;
+            if (insideComment(input, start, line)) {
+                // Text that only looks like a tag section, inside a multi-line comment
+                const size_t close = input.find('}', line);
+                newline = close == std::string_view::npos ? close : input.find("\n[", close);
+                continue;
+            }
+            if (opensTagSection(input, line) && startsWithTag(input, line)) break;
+            newline = input.find("\n[", line);
+        }
+        cut = newline == std::string_view::npos ? input.size() : newline + 1;
+        chunks.push_back(input.substr(start, cut - start));
+        start = cut;
+    }
+    return chunks;
+}
+
+PgnIngestResult ingestPgn(const std::string_view input, const int threads, const size_t chunkBytes) {
+    const std::vector<std::string_view> chunks = splitPgnChunks(input, chunkBytes);
+
+    // Each chunk counts its own games; global game indices are only known once earlier chunks are merged
+    struct ChunkResult {
+        size_t games = 0;
+        PgnIngestResult stats;
+    };
+    std::vector<ChunkResult> results(chunks.size());
+
+    runWorkStealing(chunks.size(), threads, [&](int, const size_t index) {
+        const std::string_view chunk = chunks[index];
+        const size_t chunkOffset = static_cast<size_t>(chunk.data() - input.data());
+        ChunkResult& result = results[index];
+
+        PgnReader reader(chunk);
+        PgnGame game;
+        PgnReplay replay;
+        while (reader.next(game)) {
+            if (replayGame(game, replay)) {
+                result.stats.valid++;
+                result.stats.plies += replay.plies;
+            } else {
+                replay.errorOffset += chunkOffset;
+                result.stats.invalid++;
+                result.stats.errors.push_back({result.games, replay});
+            }
+            result.games++;
+        }
+    });
+
+    PgnIngestResult merged;
+    size_t firstGame = 0;
+    for (ChunkResult& result : results) {
+        merged.valid += result.stats.valid;
+        merged.invalid += result.stats.invalid;
+        merged.plies += result.stats.plies;
+        for (PgnGameError& error : result.stats.errors) {
+            error.gameIndex += firstGame;
+            merged.errors.push_back(error);
+        }
+        firstGame += result.games;
+    }
+    return merged;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "game.h"
+
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~ Tokenizer ~~~~~~~~~~~~~~~~
+// Every token is a view into the input, so reading a PGN file copies and allocates nothing.
+
+enum class PgnTokenType {
+    Tag,            // [Name "Value"]
+    MoveNumber,     // "12." or "12..."
+    Move,           // SAN, possibly followed by !/? annotations
+    Nag,            // $12
+    Comment,        // {...} or ; to the end of the line
+    VariationStart, // (
+    VariationEnd,   // )
+    Result,         // 1-0, 0-1, 1/2-1/2 or *
+    Invalid,        // anything that starts no token, e.g. a stray '}' or a malformed tag
+    End
+};
+
+struct PgnToken {
+    PgnTokenType type = PgnTokenType::End;
+    // The token as it appears in the input
+    std::string_view text;
+    // Tag tokens only; value is the text between the quotes with escapes left in place
+    std::string_view name;
+    std::string_view value;
+};
+
+class PgnTokenizer {
+public:
+    explicit PgnTokenizer(const std::string_view input) : input(input) {}
+
+    PgnToken next();
+    size_t position() const { return pos; }
+
+private:
+    PgnToken readTag();
+
+    std::string_view input;
+    size_t pos = 0;
+};
+
+// ~~~~~~~~~~~~~~~~ Games ~~~~~~~~~~~~~~~~
+
+enum class GameResult : uint8_t {
+    Unknown = 0,
+    WhiteWins,
+    BlackWins,
+    Draw
+};
+GameResult parseResult(std::string_view text);
+
+struct PgnTag {
+    std::string_view name;
+    std::string_view value;
+};
+
+// Tags past this many are skipped; real archives rarely carry more than a dozen
+constexpr int MAX_PGN_TAGS = 32;
+
+struct PgnGame {
+    PgnTag tags[MAX_PGN_TAGS];
+    int tagCount = 0;
+    // The whole game from its first tag through its result, and just the part after the tags
+    std::string_view text;
+    std::string_view movetext;
+    // Byte offset of text within the reader's input
+    size_t offset = 0;
+
+    // Value of the named tag, or an empty view
+    std::string_view tag(std::string_view name) const;
+};
+
+// Splits PGN text into games. A game ends at its result token, or where the next game's tags begin
+// when the result is missing.
+class PgnReader {
+public:
+    explicit PgnReader(const std::string_view input) : input(input), tokens(input) {}
+
+    // Fills game with the next game; returns false once the input is exhausted
+    bool next(PgnGame& game);
+    size_t position() const { return tokens.position(); }
+
+private:
+    std::string_view input;
+    PgnTokenizer tokens;
+};
+
+// ~~~~~~~~~~~~~~~~ Replay ~~~~~~~~~~~~~~~~
+
+struct PgnReplay {
+    bool ok = false;
+    int plies = 0;
+    // From the result token, or the Result tag when the movetext has none
+    GameResult result = GameResult::Unknown;
+    // On failure: a description, the offending token and its byte offset in the reader's input
+    const char* error = nullptr;
+    std::string_view errorToken;
+    size_t errorOffset = 0;
+};
+
+// Replays the main line of game from the standard start position, or from its FEN tag, through
+// parseSAN() and makeMove(). Comments, NAGs and variations are skipped. When given, onMove sees
+// the position before every main-line move. Returns replay.ok.
+bool replayGame(const PgnGame& game, PgnReplay& replay,
+                const std::function<void(const GameData& position, uint16_t move)>& onMove = nullptr);
+
+// ~~~~~~~~~~~~~~~~ Parallel ingestion ~~~~~~~~~~~~~~~~
+
+// Large enough that per-chunk overhead disappears, small enough that a few hundred MB still
+// gives work stealing plenty of tasks to balance
+constexpr size_t DEFAULT_PGN_CHUNK_BYTES = 4 << 20;
+
+// Cuts input into consecutive chunks of roughly chunkBytes. Every cut is made at the start of a
+// line that opens a tag section (a well-formed tag line, outside any comment, not preceded by
+// another tag line), so each chunk holds whole games and reads exactly as it would as part of the
+// whole file.
+std::vector<std::string_view> splitPgnChunks(std::string_view input, size_t chunkBytes = DEFAULT_PGN_CHUNK_BYTES);
+
+struct PgnGameError {
+    // Position of the game in the input, counting from 0
+    size_t gameIndex = 0;
+    // errorOffset is relative to the whole input, not the chunk
+    PgnReplay replay;
+};
+
+struct PgnIngestResult {
+    size_t valid = 0;
+    size_t invalid = 0;
+    uint64_t plies = 0;
+    // In input order
+    std::vector<PgnGameError> errors;
+};
+
+// Replays every game in input with splitPgnChunks() and one task per chunk on `threads` workers,
+// then merges the per-chunk results in input order. Same result as a single PgnReader pass.
+PgnIngestResult ingestPgn(std::string_view input, int threads, size_t chunkBytes = DEFAULT_PGN_CHUNK_BYTES);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "game.h"
+#include "mappedfile.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// ~~~~~~~~~~~~~~~~ Polyglot keys ~~~~~~~~~~~~~~~~
+// Polyglot books key positions with their own fixed table of 781 random numbers, unrelated to the
+// engine's Zobrist keys, so the key is computed from the position when a book is probed instead of
+// being carried through makeMove().
+
+namespace Polyglot {
+    // 12 x 64 piece keys (black pawn, white pawn, black knight, ... white king; a1 = 0), then the
+    // four castling rights (K, Q, k, q), eight en passant files and the white-to-move key
+    extern const uint64_t randomKeys[781];
+}
+
+uint64_t polyglotKey(const GameData& g);
+
+// Polyglot moves put the destination in bits 0-5 and the origin in bits 6-11, the reverse of the
+// engine's encoding, use the same promotion numbering, and write castling as the king taking its
+// own rook. Book moves are untrusted, so fromPolyglotMove() returns INVALID_MOVE for one that is not
+// legal in g; toPolyglotMove() expects a move that is.
+uint16_t fromPolyglotMove(const GameData& g, uint16_t bookMove);
+uint16_t toPolyglotMove(const GameData& g, uint16_t move);
+
+// ~~~~~~~~~~~~~~~~ Book ~~~~~~~~~~~~~~~~
+
+// A .bin book is an array of 16-byte big-endian entries sorted by key, several per position
+constexpr size_t POLYGLOT_ENTRY_SIZE = 16;
+
+struct PolyglotEntry {
+    uint64_t key;
+    uint16_t move;
+    uint16_t weight;
+    uint32_t learn;
+};
+
+struct BookMove {
+    // Engine encoding
+    uint16_t move;
+    uint16_t weight;
+};
+
+class PolyglotBook {
+public:
+    // Maps path; fails unless the size is a whole number of entries
+    bool open(const char* path);
+
+    size_t entryCount() const { return file.size() / POLYGLOT_ENTRY_SIZE; }
+    PolyglotEntry entry(size_t index) const;
+    // Index of the first entry whose key is not less than key
+    size_t lowerBound(uint64_t key) const;
+
+    // Fills moves with the book moves for g that are legal there, in book order, and returns how
+    // many there are (at most maxMoves)
+    int probe(const GameData& g, BookMove* moves, int maxMoves) const;
+    // The heaviest book move, or INVALID_MOVE when g is not in the book
+    uint16_t bestMove(const GameData& g) const;
+    // A book move picked with probability proportional to its weight, or INVALID_MOVE. random is
+    // any uniformly distributed 64-bit value, so the caller owns the generator and its seed.
+    uint16_t weightedMove(const GameData& g, uint64_t random) const;
+
+private:
+    MappedFile file;
+};
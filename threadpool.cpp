@@ -0,0 +1,67 @@
+#include "threadpool.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+
+        bool popBack(size_t& index) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tasks.empty()) return false;
+            index = tasks.back();
+            tasks.pop_back();
+            return true;
+        }
+        bool stealFront(size_t& index) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tasks.empty()) return false;
+            index = tasks.front();
+            tasks.pop_front();
+            return true;
+        }
+    };
+}
+
+void runWorkStealing(const size_t taskCount, int threads, const std::function<void(int worker, size_t index)>& task) {
+    if (threads < 1) threads = 1;
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    for (int i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < taskCount; i++) {
+        queues[i % threads]->tasks.push_back(i);
+    }
+
+    // No tasks are added after startup, so a worker that finds every queue empty can stop
+    auto worker = [&](const int self) {
+        size_t index;
+        while (true) {
+            if (queues[self]->popBack(index)) {
+                task(self, index);
+                continue;
+            }
+            bool stolen = false;
+            for (int offset = 1; offset < threads && !stolen; offset++) {
+                stolen = queues[(self + offset) % threads]->stealFront(index);
+            }
+            if (!stolen) return;
+            task(self, index);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) {
+        pool.emplace_back(worker, i);
+    }
+    worker(0);
+    for (std::thread& t : pool) {
+        t.join();
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Runs task(worker, index) for every index in [0, taskCount) on `threads` worker threads.
+// Tasks are dealt round-robin into per-worker deques; a worker takes from the back of its own
+// deque and, once that is empty, steals from the front of the others'. Returns when all tasks are done.
+void runWorkStealing(size_t taskCount, int threads, const std::function<void(int worker, size_t index)>& task);
@@ -0,0 +1,63 @@
+#include "game.h"
+
+namespace Zobrist {
+    // SplitMix64: a fixed seed gives the same keys on every build, so hashes can be stored on disk
+    constexpr uint64_t nextRandom(uint64_t& state) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    struct Keys {
+        std::array<std::array<uint64_t, 64>, 12> pieces{};
+        uint64_t side = 0;
+        std::array<uint64_t, 16> castling{};
+        std::array<uint64_t, 8> epFile{};
+    };
+
+    constexpr Keys generateKeys() {
+        Keys keys;
+        uint64_t state = 0x2C4E6F1A5B3D7981ULL;
+        for (auto& piece : keys.pieces) {
+            for (uint64_t& key : piece) {
+                key = nextRandom(state);
+            }
+        }
+        keys.side = nextRandom(state);
+        // Castling rights hash as one key per combination so updates are a single XOR pair
+        for (uint64_t& key : keys.castling) {
+            key = nextRandom(state);
+        }
+        keys.castling[0] = 0;
+        for (uint64_t& key : keys.epFile) {
+            key = nextRandom(state);
+        }
+        return keys;
+    }
+
+    constexpr Keys keys = generateKeys();
+
+    constexpr std::array<std::array<uint64_t, 64>, 12> pieceKeys = keys.pieces;
+    constexpr uint64_t sideKey = keys.side;
+    constexpr std::array<uint64_t, 16> castlingKeys = keys.castling;
+    constexpr std::array<uint64_t, 8> epFileKeys = keys.epFile;
+}
+
+// Hashes the position from scratch: pieces, side to move, castling rights and en passant file
+uint64_t computeHash(const GameData& g) {
+    uint64_t hash = 0ULL;
+    for (int piece = 0; piece < 12; piece++) {
+        // Piece index color * 6 + type is exactly the layout of BitBoards::pieces
+        uint64_t bb = g.boards.pieces[piece / NUM_PIECE_TYPES][piece % NUM_PIECE_TYPES];
+        while (bb) {
+            hash ^= Zobrist::pieceKeys[piece][popLsb(bb)];
+        }
+    }
+    if (!g.state.isWhiteTurn) hash ^= Zobrist::sideKey;
+    hash ^= Zobrist::castlingKeys[g.state.castling & 0xF];
+    if (epInHash(g.boards, g.state.epSquare, g.state.isWhiteTurn)) {
+        hash ^= Zobrist::epFileKeys[getFile(g.state.epSquare)];
+    }
+    return hash;
+}